@@ -2,15 +2,20 @@
 
 #include <algorithm>
 #include <atomic>
+#include <cerrno>
+#include <cmath>
 #include <chrono>
+#include <condition_variable>
 #include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
 #include <mutex>
 #include <regex>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 #ifdef _MSC_VER
@@ -22,6 +27,28 @@
 #define STDERR_FILENO 2
 #endif
 
+#ifndef _WIN32
+#include <fcntl.h>   // open, posix_fallocate
+#include <netdb.h>   // getaddrinfo
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h> // writev
+#include <unistd.h>  // write
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h> // mmap
+#include <sys/un.h>   // sockaddr_un
+#endif
+
+#if LOGURU_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#if LOGURU_WITH_LZ4
+#include <lz4frame.h>
+#endif
+
 #ifdef __linux__
 #include <linux/limits.h> // PATH_MAX
 #elif !defined(_WIN32)
@@ -49,6 +76,7 @@
 #ifdef _WIN32
 #include <Windows.h>
 #include <direct.h>
+#include <io.h> // _write
 #include <share.h>
 #ifndef _SH_DENYWR
 #define _SH_DENYWR 32
@@ -98,6 +126,12 @@ int vasprintf(char **strp, const char *fmt, va_list ap)
 #endif
 #endif
 
+#ifndef _WIN32
+// The MSVC CRT names used below.
+#define _strdup strdup
+#define _getcwd getcwd
+#endif
+
 #if LOGURU_STACKTRACES
 #include <cxxabi.h>    // for __cxa_demangle
 #include <dlfcn.h>     // for dladdr
@@ -120,10 +154,37 @@ for storing thread names on Linux. */
 #define LOGURU_PTLS_NAMES 0
 #endif
 
+#ifdef __APPLE__
+#define LOGURU_THREAD_LOCAL __thread
+#elif defined(_MSC_VER) && _MSC_VER <= 1800
+#define LOGURU_THREAD_LOCAL __declspec(thread)
+#else
+#define LOGURU_THREAD_LOCAL thread_local
+#endif
+
 namespace loguru
 {
 	using namespace std::chrono;
 
+	// When to flush an output: after every line, or within an interval of its first unflushed line.
+	struct SinkFlush
+	{
+		std::atomic<int>       interval_ms{-1};   // -1 means g_flush_interval_ms. See set_flush_interval.
+		std::atomic<long long> dirty_since_ns{0}; // now_ns() of the first unflushed line, 0 if none.
+		bool                   batches = false;   // Never flushed after every line (compressed frames).
+		bool                   flush_after_batch = false; // Protected by s_mutex. See s_thread_is_draining.
+	};
+
+	// Counters of one output, for get_output_stats. Thread-safe callbacks may update them concurrently.
+	struct SinkStats
+	{
+		std::atomic<unsigned long long> messages{0};
+		std::atomic<unsigned long long> bytes{0};
+		std::atomic<unsigned long long> flushes{0};
+		std::atomic<long long>          total_ns{0};
+		std::atomic<long long>          max_ns{0};
+	};
+
 	struct Callback
 	{
 		std::string     id;
@@ -132,10 +193,46 @@ namespace loguru
 		Verbosity       verbosity; // Does not change!
 		close_handler_t close;
 		flush_handler_t flush;
-		unsigned        indentation;
+		bool            thread_safe; // Called without s_mutex, possibly from several threads at once.
+		std::shared_ptr<SinkFlush> flush_state; // Shared by the copies in all snapshots.
+		unsigned        preamble_fields; // See set_preamble_fields.
+		std::shared_ptr<SinkStats> stats; // Shared by the copies in all snapshots.
+	};
+
+	// What the preamble of a message is made of, captured when it is logged.
+	struct PreambleInfo
+	{
+		unsigned    parts;      // Preamble_All, or Preamble_None for RAW_LOG_F.
+		Verbosity   verbosity;
+		const char* file;
+		unsigned    line;
+		long long   ms_since_epoch;
+		long long   uptime_ms;
+		char        thread[12]; // The name or index, as shown.
+		long long   time_ns;    // now_ns(), for the time spent in the async queue. 0 for RAW_LOG_F.
+	};
+
+	// The preambles of one message, each built when the first output needs it and shared by the others.
+	class Preambles
+	{
+	public:
+		explicit Preambles(const PreambleInfo& info) : _info(info) {}
+
+		const char* get(unsigned fields);
+
+	private:
+		Preambles(const Preambles&) = delete;
+		Preambles& operator=(const Preambles&) = delete;
+
+		static const int MAX_BUILT = 3; // Any more distinct fields are rebuilt in the last buffer.
+
+		const PreambleInfo& _info;
+		int                 _num_built = 0;
+		unsigned            _fields[MAX_BUILT];
+		char                _buffs[MAX_BUILT][128];
 	};
 
-#if _MSC_VER < 1900
+#if defined(_WIN32) && (!defined(_MSC_VER) || _MSC_VER < 1900)
 
 #define snprintf c99_snprintf
 #define vsnprintf c99_vsnprintf
@@ -171,6 +268,16 @@ namespace loguru
 
 	using CallbackVec = std::vector<Callback>;
 
+	// Replaced, never modified, when a callback is added or removed.
+	struct MappedFile;
+
+	struct CallbackList
+	{
+		CallbackVec callbacks;
+		bool        has_thread_safe;
+		MappedFile* mapped_file; // The user_data of the add_mapped_file output, if any.
+	};
+
 	using StringPair = std::pair<std::string, std::string>;
 	using StringPairList = std::vector<StringPair>;
 
@@ -181,29 +288,149 @@ namespace loguru
 	Verbosity g_stderr_verbosity = Verbosity_0;
 	bool      g_colorlogtostderr = true;
 	unsigned  g_flush_interval_ms = 0;
+	unsigned  g_dedup_window_ms = 0;
+	bool      g_preamble_thread_index = false;
+	bool      g_time_outputs = false;
 
   bool time_off = true;
 
-  static bool error_on = true;
-  static bool warning_on = true;
-  static bool info_on = true;
-  static bool name_on = true;
+	// Everything the logging fast path filters on, so that it is one relaxed load and safe to change from any thread.
+	// The low bits are the set_log() switches, the byte above them is the highest verbosity of any callback.
+	enum FilterBits : unsigned
+	{
+		Filter_ErrorOn   = 1 << 0,
+		Filter_WarningOn = 1 << 1,
+		Filter_InfoOn    = 1 << 2,
+		Filter_NameOn    = 1 << 3,
+	};
+	const unsigned FILTER_CUTOFF_SHIFT  = 8;
+	const int      FILTER_CUTOFF_OFFSET = 128; // Stored unsigned.
+
+	static unsigned make_filter_cutoff(Verbosity verbosity)
+	{
+		return static_cast<unsigned>(verbosity + FILTER_CUTOFF_OFFSET) << FILTER_CUTOFF_SHIFT;
+	}
+
+	alignas(64) static std::atomic<unsigned> s_filter{
+		Filter_ErrorOn | Filter_WarningOn | Filter_InfoOn | Filter_NameOn | make_filter_cutoff(Verbosity_OFF) };
+
+	// The highest verbosity of any callback but the flight recorder.
+	static std::atomic<int> s_outputs_verbosity{Verbosity_OFF};
+
+	static bool is_filter_on(unsigned bit)
+	{
+		return (s_filter.load(std::memory_order_relaxed) & bit) != 0;
+	}
+
+	static void set_filter_bit(unsigned bit, bool on)
+	{
+		if (on) {
+			s_filter.fetch_or(bit, std::memory_order_relaxed);
+		} else {
+			s_filter.fetch_and(~bit, std::memory_order_relaxed);
+		}
+	}
 
+	static void set_filter_cutoff(Verbosity verbosity)
+	{
+		const unsigned cutoff_mask = 0xffu << FILTER_CUTOFF_SHIFT;
+		unsigned filter = s_filter.load(std::memory_order_relaxed);
+		while (!s_filter.compare_exchange_weak(filter, (filter & ~cutoff_mask) | make_filter_cutoff(verbosity),
+			std::memory_order_relaxed)) { }
+	}
 
 	static std::recursive_mutex  s_mutex;
-	static Verbosity             s_max_out_verbosity = Verbosity_OFF;
 	static std::string           s_argv0_filename;
 	static std::string           s_arguments;
 	static char                  s_current_dir[PATH_MAX];
-	static CallbackVec           s_callbacks;
 	static fatal_handler_t       s_fatal_handler = nullptr;
-	static StringPairList        s_user_stack_cleanups;
+	static char                  s_crash_path[PATH_MAX] = ""; // See set_crash_file. Empty for none.
+	static unsigned              s_crash_num_records = 0;
+	static StringPairList        s_user_stack_cleanups;    // Protected by s_symbol_mutex.
+	static bool                  s_stack_cleanups_changed = true; // Protected by s_symbol_mutex.
+	static std::mutex            s_symbol_mutex;
 	static bool                  s_strip_file_path = true;
-	static std::atomic<unsigned> s_stderr_indentation{ 0 };
 
-	// For periodic flushing:
-	static std::thread* s_flush_thread = nullptr;
-	static bool         s_needs_flushing = false;
+	// Read with s_mutex locked, or within a CallbackReader. null when empty.
+	static std::atomic<const CallbackList*> s_callbacks{ nullptr };
+
+	// For periodic flushing (see mark_dirty):
+	static SinkFlush               s_stderr_flush;
+	static std::mutex              s_flusher_mutex;
+	static std::condition_variable s_flusher_cv;
+	static std::thread*            s_flusher_thread = nullptr; // Protected by s_flusher_mutex.
+	static bool                    s_flusher_wake = false;     // Protected by s_flusher_mutex.
+	static bool                    s_flusher_stop = false;     // Protected by s_flusher_mutex.
+	static bool                    s_flusher_at_exit = false;  // Protected by s_flusher_mutex.
+
+	// Set while this thread drains the async queue: outputs that flush after every line then flush once per batch.
+	static LOGURU_THREAD_LOCAL bool s_thread_is_draining = false;
+
+	const size_t   STATS_CACHE_LINE = 64;
+	const unsigned NUM_STATS_SHARDS = 16;
+
+	// The counters that every logging thread updates. Each thread uses the shard of its get_thread_index(),
+	// on a cache line of its own, and get_stats sums them.
+	struct alignas(STATS_CACHE_LINE) StatsShard
+	{
+		std::atomic<unsigned long long> messages[Verbosity_MAX - Verbosity_FATAL + 1];
+		std::atomic<long long>          format_ns{0};
+		std::atomic<long long>          lock_wait_ns{0};
+	};
+
+	// For get_stats. Relaxed, since they are only read for reporting.
+	struct LoggerStats
+	{
+		StatsShard                      shards[NUM_STATS_SHARDS];
+		// Updated by the async writer thread.
+		alignas(STATS_CACHE_LINE) std::atomic<long long> async_queue_ns{0};
+		std::atomic<long long>          async_queue_max_ns{0};
+		std::atomic<long long>          async_full_ns{0};
+		alignas(STATS_CACHE_LINE) std::atomic<unsigned long long> sink_dropped{0};
+		alignas(STATS_CACHE_LINE) SinkStats stderr_stats; // Updated with s_mutex locked.
+	};
+
+	static LoggerStats                     s_stats;
+	static SinkFlush                       s_stats_flush; // Dirty while there is something new to report.
+	static LOGURU_THREAD_LOCAL bool        s_thread_is_logging_stats = false;
+	static LOGURU_THREAD_LOCAL unsigned    s_num_formatted = 0; // To time one message in FORMAT_SAMPLE_INTERVAL.
+	const unsigned                         FORMAT_SAMPLE_INTERVAL = 64;
+
+	static void stats_add(std::atomic<long long>& counter, long long value)
+	{
+		counter.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	static void stats_max(std::atomic<long long>& counter, long long value)
+	{
+		long long old = counter.load(std::memory_order_relaxed);
+		while (value > old && !counter.compare_exchange_weak(old, value, std::memory_order_relaxed)) { }
+	}
+
+	static StatsShard& stats_shard()
+	{
+		return s_stats.shards[get_thread_index() % NUM_STATS_SHARDS];
+	}
+
+	// Only thread-safe callbacks are called concurrently: the others are called with s_mutex locked,
+	// so a plain load and store is enough.
+	static void stats_count_call(SinkStats& stats, size_t bytes, bool concurrent)
+	{
+		if (concurrent) {
+			stats.messages.fetch_add(1, std::memory_order_relaxed);
+			stats.bytes.fetch_add(bytes, std::memory_order_relaxed);
+		}
+		else {
+			stats.messages.store(stats.messages.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			stats.bytes.store(stats.bytes.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+		}
+	}
+
+	static void stats_time_call(SinkStats& stats, long long ns)
+	{
+		stats_add(stats.total_ns, ns);
+		stats_max(stats.max_ns, ns);
+	}
 
 	static const bool s_terminal_has_color = []() {
 #ifdef _MSC_VER
@@ -226,6 +453,17 @@ namespace loguru
   const auto THREAD_NAME_WIDTH = 2; //16;
 	const auto PREAMBLE_EXPLAIN = "date       time         ( uptime  ) [ thread name/id ]                   file:line     v| ";
 
+	// Per-thread caches for print_preamble:
+	static LOGURU_THREAD_LOCAL long long s_date_time_sec = -1;
+	static LOGURU_THREAD_LOCAL char      s_date_time[6 * 11 + 6]; // "YYYY-MM-DD hh:mm:ss", with room for any int in each field.
+	static LOGURU_THREAD_LOCAL bool      s_thread_name_cached = false;
+	static LOGURU_THREAD_LOCAL char      s_thread_name[THREAD_NAME_WIDTH + 1];
+	static LOGURU_THREAD_LOCAL unsigned  s_thread_index = 0; // 0 means not yet assigned.
+	static std::atomic<unsigned>         s_num_thread_indices{0};
+
+	// Per-thread state for the binary file:
+	static LOGURU_THREAD_LOCAL unsigned  s_binary_thread_generation = 0; // Of the file our name was written to.
+
 #if LOGURU_PTLS_NAMES
 	static pthread_once_t s_pthread_key_once = PTHREAD_ONCE_INIT;
 	static pthread_key_t  s_pthread_key_name;
@@ -240,6 +478,15 @@ namespace loguru
 	// Colors
 #if _MSC_VER
   HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+  static WORD s_console_attribute = 0; // The last one set, so that lines of the same color don't set it again.
+
+  static void set_console_attribute(WORD attribute)
+  {
+    if (attribute != s_console_attribute) {
+      SetConsoleTextAttribute(hConsole, attribute);
+      s_console_attribute = attribute;
+    }
+  }
 
   // Colors
   const char* terminal_black() { return ""; }
@@ -286,26 +533,224 @@ namespace loguru
 
 	// ------------------------------------------------------------------------------
 
+	// A file from add_file. Lines are gathered in 'buffer' and written with a single write/writev
+	// when it is full, when it is flushed, and right away for ERROR and FATAL.
+	// With a flush interval of 0 (the default) it is flushed after every line.
+	struct FileSink
+	{
+		FILE*        file;          // Only for opening and closing. Never written through, so it has no buffered data.
+		int          fd;
+		char*        buffer;        // LOGURU_FILE_BUFFER_SIZE bytes.
+		size_t       size;          // Bytes waiting in buffer.
+		std::string  path;
+		size_t       file_size;     // Bytes in the file so far.
+		FileRotation rotation;
+		time_t       next_rollover; // For Rotation_Hourly and Rotation_Daily. Only used by the flusher thread.
+		bool         rotation_requested; // The next line would go past max_size. Protected by s_mutex.
+	};
+
+	static FILE* open_log_file(const char* path, const char* mode_str)
+	{
+		FILE* file = nullptr;
+#ifdef _WIN32
+		file = _fsopen(path, mode_str, _SH_DENYWR);
+#else
+		file = fopen(path, mode_str);
+#endif
+		return file;
+	}
+
+	static int file_descriptor(FILE* file)
+	{
+#ifdef _WIN32
+		return _fileno(file);
+#else
+		return fileno(file);
+#endif
+	}
+
+	// The start of the next hour or day, local time.
+	static time_t next_rollover_time(RotationInterval interval)
+	{
+		if (interval == Rotation_None) { return 0; }
+		time_t now = time(nullptr);
+		tm time_info;
+#if defined(_MSC_VER)
+		localtime_s(&time_info, &now);
+#elif defined(__BORLANDC__)
+		localtime_s(&now, &time_info);
+#else
+		localtime_r(&now, &time_info);
+#endif
+		time_info.tm_min = 0;
+		time_info.tm_sec = 0;
+		if (interval == Rotation_Hourly) {
+			time_info.tm_hour += 1;
+		} else {
+			time_info.tm_hour = 0;
+			time_info.tm_mday += 1;
+		}
+		time_info.tm_isdst = -1;
+		return mktime(&time_info); // Normalizes the overflowing field.
+	}
+
+	struct Chunk
+	{
+		const char* data;
+		size_t      size;
+	};
+
+#ifndef _WIN32
+	// Writes all of it, with as few syscalls as possible. Gives up on error (e.g. disk full).
+	static void write_iov(int fd, iovec* iov, int num_iov)
+	{
+		while (num_iov > 0) {
+			const ssize_t written = writev(fd, iov, num_iov);
+			if (written < 0 && errno == EINTR) { continue; }
+			if (written <= 0) { break; }
+			// Skip what was written, in case it was a partial write.
+			size_t left = static_cast<size_t>(written);
+			while (num_iov > 0 && left >= iov->iov_len) {
+				left -= iov->iov_len;
+				++iov;
+				--num_iov;
+			}
+			if (num_iov > 0) {
+				iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+				iov->iov_len -= left;
+			}
+		}
+	}
+#endif
+
+	// Writes out the buffer followed by 'chunks' in as few syscalls as possible. Gives up on error (e.g. disk full).
+	static void file_sink_write(FileSink& sink, const Chunk* chunks, int num_chunks)
+	{
+		size_t total = sink.size;
+		for (int i = 0; i < num_chunks; ++i) {
+			total += chunks[i].size;
+		}
+		sink.file_size += total;
+
+#ifdef _WIN32
+		auto write_all = [&](const char* data, size_t size) {
+			while (size > 0) {
+				const int written = _write(sink.fd, data, static_cast<unsigned>(std::min<size_t>(size, 1 << 30)));
+				if (written <= 0) { return false; }
+				data += written;
+				size -= static_cast<size_t>(written);
+			}
+			return true;
+		};
+		bool ok = write_all(sink.buffer, sink.size);
+		for (int i = 0; ok && i < num_chunks; ++i) {
+			ok = write_all(chunks[i].data, chunks[i].size);
+		}
+#else
+		iovec iov[8];
+		int num_iov = 0;
+		if (sink.size > 0) {
+			iov[num_iov++] = iovec{ sink.buffer, sink.size };
+		}
+		for (int i = 0; i < num_chunks && num_iov < 8; ++i) {
+			if (chunks[i].size > 0) {
+				iov[num_iov++] = iovec{ const_cast<char*>(chunks[i].data), chunks[i].size };
+			}
+		}
+		write_iov(sink.fd, iov, num_iov);
+#endif
+		sink.size = 0;
+	}
+
+	static void file_sink_append(FileSink& sink, const Chunk* chunks, int num_chunks, bool flush_now)
+	{
+		size_t total = 0;
+		for (int i = 0; i < num_chunks; ++i) {
+			total += chunks[i].size;
+		}
+
+		if (sink.size + total > LOGURU_FILE_BUFFER_SIZE) {
+			file_sink_write(sink, chunks, num_chunks); // Too big to gather: write it together with the buffer.
+			return;
+		}
+
+		for (int i = 0; i < num_chunks; ++i) {
+			memcpy(sink.buffer + sink.size, chunks[i].data, chunks[i].size);
+			sink.size += chunks[i].size;
+		}
+		if (flush_now) {
+			file_sink_write(sink, nullptr, 0);
+		}
+	}
+
+	static void file_sink_printf(FileSink& sink, const char* format, ...) LOGURU_PRINTF_LIKE(2, 3);
+	static void file_sink_printf(FileSink& sink, const char* format, ...)
+	{
+		char buff[PATH_MAX + 64];
+		va_list vlist;
+		va_start(vlist, format);
+		const int length = vsnprintf(buff, sizeof(buff), format, vlist);
+		va_end(vlist);
+		if (length > 0) {
+			const Chunk chunk = { buff, std::min(static_cast<size_t>(length), sizeof(buff) - 1) };
+			file_sink_append(sink, &chunk, 1, false);
+		}
+	}
+
+	// The lines at the top of every file: also written after each rotation.
+	static void file_sink_write_header(FileSink& sink)
+	{
+		if (!s_arguments.empty())
+		{
+			file_sink_printf(sink, "arguments: %s\n", s_arguments.c_str());
+		}
+		if (strlen(s_current_dir) != 0)
+		{
+			file_sink_printf(sink, "Current dir: %s\n", s_current_dir);
+		}
+	}
+
+	static void wake_flusher();
+
 	void file_log(void* user_data, const Message& message)
 	{
-		FILE* file = reinterpret_cast<FILE*>(user_data);
-		fprintf(file, "%s%s%s%s\n",
-			message.preamble, message.indentation, message.prefix, message.message);
-		if (g_flush_interval_ms == 0) {
-			fflush(file);
+		FileSink& sink = *reinterpret_cast<FileSink*>(user_data);
+		const Chunk chunks[] = {
+			{ message.preamble,    strlen(message.preamble)    },
+			{ message.indentation, strlen(message.indentation) },
+			{ message.prefix,      strlen(message.prefix)      },
+			{ message.message,     strlen(message.message)     },
+			{ "\n",                1                           },
+		};
+		if (sink.rotation.max_size != 0 && !sink.rotation_requested) {
+			const size_t size = sink.file_size + sink.size;
+			const size_t line_size = chunks[0].size + chunks[1].size + chunks[2].size + chunks[3].size + 1;
+			if (size > 0 && size + line_size > sink.rotation.max_size) {
+				// Rotated by the flusher thread: the file grows past max_size by the lines logged until then.
+				sink.rotation_requested = true;
+				wake_flusher();
+			}
 		}
+		file_sink_append(sink, chunks, 5, message.verbosity <= Verbosity_ERROR);
 	}
 
 	void file_close(void* user_data)
 	{
-		FILE* file = reinterpret_cast<FILE*>(user_data);
-		fclose(file);
+		FileSink* sink = reinterpret_cast<FileSink*>(user_data);
+		if (sink->size > 0) {
+			file_sink_write(*sink, nullptr, 0);
+		}
+		fclose(sink->file);
+		delete[] sink->buffer;
+		delete sink;
 	}
 
 	void file_flush(void* user_data)
 	{
-		FILE* file = reinterpret_cast<FILE*>(user_data);
-		fflush(file);
+		FileSink& sink = *reinterpret_cast<FileSink*>(user_data);
+		if (sink.size > 0) {
+			file_sink_write(sink, nullptr, 0);
+		}
 	}
 
 	// ------------------------------------------------------------------------------
@@ -346,6 +791,82 @@ namespace loguru
 		return Text(static_cast<char*>(calloc(1, 1)));
 	}
 
+	static long long now_ns();
+
+	// Formats into a buffer on the stack, and only allocates if the result does not fit.
+	// On the stack rather than thread-local, so that logging from within a callback can't clobber it.
+	class FormatBuffer
+	{
+	public:
+		LOGURU_PRINTF_LIKE(2, 0)
+		FormatBuffer(const char* format, va_list vlist)
+		{
+			const bool timed = ++s_num_formatted % FORMAT_SAMPLE_INTERVAL == 0;
+			const long long start_ns = timed ? now_ns() : 0;
+			va_list vlist_copy;
+			va_copy(vlist_copy, vlist);
+			const int length = vsnprintf(_buff, sizeof(_buff), format, vlist_copy);
+			va_end(vlist_copy);
+			CHECK_F(length >= 0, "Bad string format: '%s'", format);
+			if (static_cast<size_t>(length) >= sizeof(_buff)) {
+				_heap = vtextprintf(format, vlist).release();
+			}
+			if (timed) {
+				stats_add(stats_shard().format_ns, (now_ns() - start_ns) * FORMAT_SAMPLE_INTERVAL);
+			}
+		}
+
+		~FormatBuffer() { free(_heap); }
+
+		const char* c_str() const { return _heap ? _heap : _buff; }
+
+	private:
+		FormatBuffer(const FormatBuffer&) = delete;
+		FormatBuffer& operator=(const FormatBuffer&) = delete;
+
+		char  _buff[LOGURU_FORMAT_BUFFER_SIZE];
+		char* _heap = nullptr;
+	};
+
+	// Text built up piece by piece, in the same way: on the stack until it outgrows LOGURU_FORMAT_BUFFER_SIZE.
+	class TextBuffer
+	{
+	public:
+		TextBuffer() { _buff[0] = '\0'; }
+		~TextBuffer() { if (_data != _buff) { free(_data); } }
+
+		void append(const char* begin, const char* end)
+		{
+			const size_t length = static_cast<size_t>(end - begin);
+			if (_size + length >= _capacity) {
+				const size_t capacity = std::max(2 * _capacity, _size + length + 1);
+				char* data = static_cast<char*>(_data == _buff ? malloc(capacity) : realloc(_data, capacity));
+				CHECK_F(data != nullptr, "Out of memory");
+				if (_data == _buff) { memcpy(data, _buff, _size + 1); }
+				_data = data;
+				_capacity = capacity;
+			}
+			memcpy(_data + _size, begin, length);
+			_size += length;
+			_data[_size] = '\0';
+		}
+
+		void push_back(char c) { append(&c, &c + 1); }
+		TextBuffer& operator+=(char c) { push_back(c); return *this; }
+		TextBuffer& operator+=(const char* str) { append(str, str + strlen(str)); return *this; }
+
+		const char* c_str() const { return _data; }
+
+	private:
+		TextBuffer(const TextBuffer&) = delete;
+		TextBuffer& operator=(const TextBuffer&) = delete;
+
+		char   _buff[LOGURU_FORMAT_BUFFER_SIZE];
+		char*  _data = _buff;
+		size_t _size = 0;
+		size_t _capacity = sizeof(_buff);
+	};
+
 	static const char* indentation(unsigned depth)
 	{
 		static const char buff[] =
@@ -360,15 +881,60 @@ namespace loguru
 		return buff + INDENTATION_WIDTH * (NUM_INDENTATIONS - depth);
 	}
 
+	// The open LOG_SCOPE_F:s of one thread. An output with verbosity v shows depth[v - Verbosity_OFF] of them.
+	struct ScopeDepths
+	{
+		unsigned short depth[Verbosity_MAX - Verbosity_OFF + 1];
+	};
+
+	static LOGURU_THREAD_LOCAL ScopeDepths s_scope_depths;
+
+	static unsigned scope_depth(const ScopeDepths& depths, Verbosity verbosity)
+	{
+		if (verbosity < Verbosity_OFF) { return 0; }
+		return depths.depth[std::min<int>(verbosity, Verbosity_MAX) - Verbosity_OFF];
+	}
+
+	// A scope is shown by (and indents) every output with verbosity >= out_verbosity.
+	static void enter_scope(Verbosity out_verbosity)
+	{
+		for (int v = std::max<int>(out_verbosity, Verbosity_OFF); v <= Verbosity_MAX; ++v) {
+			++s_scope_depths.depth[v - Verbosity_OFF];
+		}
+	}
+
+	static void leave_scope(Verbosity out_verbosity)
+	{
+		for (int v = std::max<int>(out_verbosity, Verbosity_OFF); v <= Verbosity_MAX; ++v) {
+			auto& depth = s_scope_depths.depth[v - Verbosity_OFF];
+			if (depth > 0) { --depth; }
+		}
+	}
+
 	static void parse_args(int& argc, char* argv[], const char* verbosity_flag)
 	{
 		int arg_dest = 1;
 		int out_argc = argc;
+		const std::string vmodule_flag = std::string(verbosity_flag) + "module"; // "-vmodule"
 
 		for (int arg_it = 1; arg_it < argc; ++arg_it) {
 			auto cmd = argv[arg_it];
 			auto arg_len = strlen(verbosity_flag);
-			if (strncmp(cmd, verbosity_flag, arg_len) == 0 && !std::isalpha(cmd[arg_len])) {
+			auto vmodule_cmd = cmd[0] == '-' && cmd[1] == '-' ? cmd + 1 : cmd; // Also accept glog's --vmodule.
+			if (strncmp(vmodule_cmd, vmodule_flag.c_str(), vmodule_flag.size()) == 0
+				&& (vmodule_cmd[vmodule_flag.size()] == '\0' || vmodule_cmd[vmodule_flag.size()] == '=')) {
+				out_argc -= 1;
+				auto value_str = vmodule_cmd + vmodule_flag.size();
+				if (value_str[0] == '\0') {
+					arg_it += 1;
+					CHECK_LT_F(arg_it, argc, "Missing spec after %s", vmodule_flag.c_str());
+					value_str = argv[arg_it];
+					out_argc -= 1;
+				}
+				if (*value_str == '=') { value_str += 1; }
+				CHECK_F(set_vmodule(value_str), "Invalid %s: '%s'", vmodule_flag.c_str(), value_str);
+			}
+			else if (strncmp(cmd, verbosity_flag, arg_len) == 0 && !std::isalpha(cmd[arg_len])) {
 				out_argc -= 1;
 				auto value_str = cmd + arg_len;
 				if (value_str[0] == '\0') {
@@ -413,7 +979,7 @@ namespace loguru
 
 	static long long now_ns()
 	{
-		return duration_cast<nanoseconds>(high_resolution_clock::now().time_since_epoch()).count();
+		return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
 	}
 
 	// Returns the part of the path after the last / or \ (if any).
@@ -429,22 +995,29 @@ namespace loguru
 
 	// ------------------------------------------------------------------------------
 
+	static void stop_flusher();
+	static bool outside_callbacks(const char* function);
+
 	static void on_atexit()
 	{
 		LOG_F(INFO, "atexit");
 		flush();
+		stop_flusher(); // In case this restarted it.
 	}
 
 	static void install_signal_handlers();
+	static Verbosity output_verbosity(Verbosity verbosity, const char* file);
 
-	static void write_hex_digit(std::string& out, unsigned num)
+	template <typename Out>
+	static void write_hex_digit(Out& out, unsigned num)
 	{
 		DCHECK_LT_F(num, 16u);
 		if (num < 10u) { out.push_back(char('0' + num)); }
 		else { out.push_back(char('A' + num - 10)); }
 	}
 
-	static void write_hex_byte(std::string& out, uint8_t n)
+	template <typename Out>
+	static void write_hex_byte(Out& out, uint8_t n)
 	{
 		write_hex_digit(out, n >> 4u);
 		write_hex_digit(out, n & 0x0f);
@@ -541,7 +1114,7 @@ namespace loguru
 		if (g_stderr_verbosity >= Verbosity_INFO) {
 			if (g_colorlogtostderr && s_terminal_has_color) {
 #if _MSC_VER
-        SetConsoleTextAttribute(hConsole, 7);
+        set_console_attribute(7);
 #endif
 				fprintf(stderr, "%s%s%s\n", terminal_reset(), terminal_dim(), PREAMBLE_EXPLAIN);
 			}
@@ -565,7 +1138,14 @@ namespace loguru
 
 	void shutdown()
 	{
+		if (!outside_callbacks("shutdown")) {
+			flush();
+			return;
+		}
 		LOG_F(INFO, "loguru::shutdown()");
+		stop_async();
+		stop_flusher();
+		close_binary_file();
 		remove_all_callbacks();
 		set_fatal_handler(nullptr);
 	}
@@ -610,7 +1190,7 @@ namespace loguru
 		return s_current_dir;
 	}
 
-	BOOL home_dir(char (&result)[1024])
+	bool home_dir(char (&result)[1024])
 	{
 #ifdef _WIN32
 #ifdef _MSC_VER
@@ -640,20 +1220,37 @@ namespace loguru
 #else // _WIN32
 		auto home = getenv("HOME");
 		CHECK_F(home != nullptr, "Missing HOME");
-		return home;
+		snprintf(result, sizeof(result), "%s", home);
+		return true;
 #endif // _WIN32
 	}
 
-	void suggest_log_path(const char* prefix, char* buff, unsigned buff_size)
+	// Copies the path with a leading '~' replaced by home_dir. Returns false (and logs) if it does not fit.
+	static bool expand_home(const char* in, char (&out)[PATH_MAX])
 	{
-		if (prefix[0] == '~') {
-      char home_str[1024] = { 0 };
-      home_dir(home_str);
-      snprintf(buff, buff_size - 1, "%s%s", home_str, prefix + 1);
+		char home[1024] = { 0 };
+		const char* rest = in;
+		if (in[0] == '~') {
+			home_dir(home);
+			rest = in + 1;
 		}
-		else {
-			snprintf(buff, buff_size - 1, "%s", prefix);
+		const size_t home_size = strlen(home);
+		const size_t rest_size = strlen(rest);
+		if (home_size + rest_size >= sizeof(out)) {
+			out[0] = '\0';
+			LOG_F(ERROR, "Path too long: '%s'", in);
+			return false;
 		}
+		memcpy(out, home, home_size);
+		memcpy(out + home_size, rest, rest_size + 1);
+		return true;
+	}
+
+	void suggest_log_path(const char* prefix, char* buff, unsigned buff_size)
+	{
+		char expanded[PATH_MAX];
+		expand_home(prefix, expanded);
+		snprintf(buff, buff_size - 1, "%s", expanded);
 
 		// Check for terminating /
 		size_t n = strlen(buff);
@@ -665,15 +1262,10 @@ namespace loguru
 			}
 		}
 
-		strncat_s(buff, strlen(buff), s_argv0_filename.c_str(), buff_size - strlen(buff) - 1);
-		strncat_s(buff, strlen(buff),"/", buff_size - strlen(buff) - 1);
+		strncat(buff, s_argv0_filename.c_str(), buff_size - strlen(buff) - 1);
+		strncat(buff, "/", buff_size - strlen(buff) - 1);
 		write_date_time(buff + strlen(buff), buff_size - strlen(buff));
-		strncat_s(buff, strlen(buff), ".log", buff_size - strlen(buff) - 1);
-
-		//strncat(buff, s_argv0_filename.c_str(), buff_size - strlen(buff) - 1);
-		//strncat(buff, "/", buff_size - strlen(buff) - 1);
-		//write_date_time(buff + strlen(buff), buff_size - strlen(buff));
-		//strncat(buff, ".log", buff_size - strlen(buff) - 1);
+		strncat(buff, ".log", buff_size - strlen(buff) - 1);
 	}
 
 	bool mkpath(const char* file_path_const)
@@ -718,16 +1310,16 @@ namespace loguru
     switch (err)
     {
     case loguru::Verbosity_ERROR:
-      error_on = onoff;
+      set_filter_bit(Filter_ErrorOn, onoff);
       break;
     case loguru::Verbosity_WARNING:
-      warning_on = onoff;
+      set_filter_bit(Filter_WarningOn, onoff);
       break;
     case loguru::Verbosity_INFO:
-      info_on = onoff;
+      set_filter_bit(Filter_InfoOn, onoff);
       break;
     case loguru::Verbosity_NAME:
-      name_on = onoff;
+      set_filter_bit(Filter_NameOn, onoff);
       break;
     case loguru::Verbosity_OFF:
       if (onoff == true)
@@ -743,610 +1335,3551 @@ namespace loguru
 
 	bool add_file(const char* path_in, FileMode mode, Verbosity verbosity)
 	{
-		char path[1024];
-		if (path_in[0] == '~') {
-            char home_str[1024] = { 0 };
-            home_dir(home_str);
-			snprintf(path, sizeof(path) - 1, "%s%s", home_str, path_in + 1);
-		}
-		else {
-			snprintf(path, sizeof(path) - 1, "%s", path_in);
-		}
+		return add_file(path_in, mode, verbosity, FileRotation{ 0, Rotation_None, 0 });
+	}
+
+	// Expands ~, creates the directories and opens the file. nullptr on failure.
+	static FileSink* open_file_sink(const char* path_in, FileMode mode, const FileRotation& rotation)
+	{
+		char path[PATH_MAX];
+		if (!expand_home(path_in, path)) { return nullptr; }
 
 		if (!mkpath(path)) {
 			LOG_F(ERROR, "Failed to create directories to '%s'", path);
 		}
 
 		const char* mode_str = (mode == FileMode::Truncate ? "w" : "a+");
-		//auto file = fopen(path, mode_str);
-		FILE * file = nullptr;
-#ifdef _WIN32
-		file = _fsopen(path, mode_str, _SH_DENYWR);
-#else
-		fopen_s(&file, path, mode_str);
-#endif
+		FILE* file = open_log_file(path, mode_str);
 		if (!file) {
 			LOG_F(ERROR, "Failed to open '%s'", path);
-			return false;
+			return nullptr;
 		}
-		add_callback(path_in, file_log, file, verbosity, file_close, file_flush);
+		fseek(file, 0, SEEK_END);
+		const long existing_size = ftell(file);
+		return new FileSink{ file, file_descriptor(file), new char[LOGURU_FILE_BUFFER_SIZE], 0,
+			path, existing_size > 0 ? static_cast<size_t>(existing_size) : 0,
+			rotation, next_rollover_time(rotation.interval), false };
+	}
+
+	bool add_file(const char* path_in, FileMode mode, Verbosity verbosity, const FileRotation& rotation)
+	{
+		FileSink* sink = open_file_sink(path_in, mode, rotation);
+		if (!sink) { return false; }
 
 		if (mode == FileMode::Append) {
-			fprintf(file, "\n");
+			file_sink_printf(*sink, "\n");
 		}
 
-		if (!s_arguments.empty())
-		{
-			fprintf(file, "arguments: %s\n", s_arguments.c_str());
-		}
-		if (strlen(s_current_dir) != 0)
-		{
-			fprintf(file, "Current dir: %s\n", s_current_dir);
+		file_sink_write_header(*sink);
+		file_sink_write(*sink, nullptr, 0);
+
+		add_callback(path_in, file_log, sink, verbosity, file_close, file_flush);
+		if (rotation.interval != Rotation_None) {
+			wake_flusher(); // So that it wakes up for the rollover.
 		}
-		fflush(file);
 
 		return true;
 	}
 
-	// Will be called right before abort().
-	void set_fatal_handler(fatal_handler_t handler)
+	/* Set while a thread writes to stderr/callbacks with s_mutex locked.
+	   Anything logged from within (a callback, the stack trace of a FATAL message, ...)
+	   is then written directly, which keeps the order and avoids re-entering the queue. */
+	static LOGURU_THREAD_LOCAL bool s_thread_is_writing = false;
+
+	class WritingScope
 	{
-		s_fatal_handler = handler;
-	}
+	public:
+		WritingScope() : _was_writing(s_thread_is_writing) { s_thread_is_writing = true; }
+		~WritingScope() { s_thread_is_writing = _was_writing; }
 
-	void add_stack_cleanup(const char* find_this, const char* replace_with_this)
+	private:
+		bool _was_writing;
+	};
+
+	/* Thread-safe callbacks are called without s_mutex, so removing one must wait for those calls to finish.
+	   Readers count themselves in one of two counters, picked by the epoch. A writer flips the epoch before
+	   waiting for a counter to drop to zero, so new readers do not keep it waiting. */
+	struct alignas(64) CallbackReaderCount
 	{
-		if (strlen(find_this) <= strlen(replace_with_this))
-		{
-			LOG_F(WARNING, "add_stack_cleanup: the replacement should be shorter than the pattern!");
-			return;
-		}
+		std::atomic<unsigned> count{ 0 };
+	};
 
-		s_user_stack_cleanups.push_back(StringPair(find_this, replace_with_this));
-	}
+	static std::atomic<unsigned> s_callback_epoch{ 0 };
+	static CallbackReaderCount   s_callback_readers[2];
+	static std::mutex            s_callback_writer_mutex; // One add/remove at a time.
+	static std::atomic<bool>     s_has_thread_safe_callbacks{ false };
+	static LOGURU_THREAD_LOCAL int s_callback_reader_depth = 0; // CallbackReaders on this thread's stack.
+	static std::vector<const CallbackList*> s_retired_callback_lists; // Protected by s_callback_writer_mutex.
 
-	static void on_callback_change()
+	class CallbackReader
 	{
-		s_max_out_verbosity = Verbosity_OFF;
-		for (const auto& callback : s_callbacks)
-		{
-			if (callback.verbosity > s_max_out_verbosity)
-				s_max_out_verbosity = callback.verbosity;
-			//	s_max_out_verbosity = std::max(s_max_out_verbosity, callback.verbosity);
+	public:
+		CallbackReader() : _counter(s_callback_readers[s_callback_epoch.load() & 1].count) { ++_counter; ++s_callback_reader_depth; }
+		~CallbackReader() { --s_callback_reader_depth; --_counter; }
+
+		// Stays valid for the lifetime of the reader.
+		const CallbackList* list() const { return s_callbacks.load(); }
+
+	private:
+		std::atomic<unsigned>& _counter;
+	};
+
+	// Returns once no CallbackReader can see a list replaced before the call.
+	static void wait_for_callback_readers()
+	{
+		for (int i = 0; i < 2; ++i) {
+			auto& readers = s_callback_readers[s_callback_epoch.fetch_add(1) & 1].count;
+			while (readers.load() != 0) {
+				std::this_thread::yield();
+			}
 		}
 	}
 
-	void add_callback(const char* id, log_handler_t callback, void* user_data,
-		Verbosity verbosity, close_handler_t on_close, flush_handler_t on_flush)
+	// True inside a callback or the fatal handler, where waiting for the other threads could mean waiting for ourselves.
+	static bool inside_callback()
 	{
-		std::lock_guard<std::recursive_mutex> lock(s_mutex);
-		s_callbacks.push_back(Callback{ id, callback, user_data, verbosity, on_close, on_flush, 0 });
-		on_callback_change();
+		return s_callback_reader_depth > 0 || s_thread_is_writing;
 	}
 
-	bool remove_callback(const char* id)
+	// Deletes a list replaced with s_callback_writer_mutex locked, once no reader can be using it.
+	// From inside a callback our caller may still be using it: the next add/remove deletes it then.
+	static void delete_callback_list(const CallbackList* old_list)
 	{
-		std::lock_guard<std::recursive_mutex> lock(s_mutex);
-		auto it = std::find_if(begin(s_callbacks), end(s_callbacks), [&](const Callback& c) { return c.id == id; });
-		if (it != s_callbacks.end()) {
-			if (it->close) { it->close(it->user_data); }
-			s_callbacks.erase(it);
-			on_callback_change();
-			return true;
-		}
-		else {
-			LOG_F(ERROR, "Failed to locate callback with id '%s'", id);
-			return false;
+		s_retired_callback_lists.push_back(old_list);
+		if (inside_callback()) { return; }
+		wait_for_callback_readers();
+		for (const CallbackList* list : s_retired_callback_lists) {
+			delete list;
 		}
+		s_retired_callback_lists.clear();
 	}
 
-	void remove_all_callbacks()
+	// Removing an output (or stopping a thread) means waiting for the calls to it to finish, so that fails from inside one.
+	static bool outside_callbacks(const char* function)
 	{
-		std::lock_guard<std::recursive_mutex> lock(s_mutex);
-		for (auto& callback : s_callbacks) {
-			if (callback.close) {
-				callback.close(callback.user_data);
+		if (!inside_callback()) { return true; }
+		// No LOG_F here: it would call the callbacks again.
+		fprintf(stderr, "Loguru: %s can't be called from inside a callback or the fatal handler\n", function);
+		return false;
+	}
+
+	// ------------------------------------------------------------------------
+	// Memory-mapped file (add_mapped_file):
+	// A writer reserves its bytes with one fetch_add on 'offset' and memcpy:s them into the mapped segment(s),
+	// without taking s_mutex. Segment k lives in slot k % NUM_SLOTS. It is mapped by whoever needs it first,
+	// and unmapped by whoever commits its last byte. A writer only waits if it got NUM_SLOTS segments ahead of
+	// the slowest writer.
+
+#ifdef __linux__
+	struct MappedSlot
+	{
+		std::atomic<size_t> segment{0};   // Segment index + 1 that is mapped here, 0 if free, SIZE_MAX while mapping.
+		std::atomic<char*>  data{nullptr};
+		std::atomic<size_t> committed{0}; // Bytes written into the segment so far.
+	};
+
+	struct MappedFile
+	{
+		static const size_t NUM_SLOTS = 4;
+
+		int                 fd;
+		Verbosity           verbosity;
+		size_t              segment_size;
+		std::atomic<size_t> offset{0};
+		MappedSlot          slots[NUM_SLOTS];
+	};
+
+	static std::atomic<MappedFile*> s_mapped_file{nullptr}; // Just to check for one cheaply, and that there is only one.
+
+	static char* mapped_segment(MappedFile& file, size_t segment)
+	{
+		MappedSlot& slot = file.slots[segment % MappedFile::NUM_SLOTS];
+		for (;;) {
+			size_t mapped = slot.segment.load(std::memory_order_acquire);
+			if (mapped == segment + 1) {
+				return slot.data.load(std::memory_order_relaxed);
+			}
+			if (mapped == 0 && slot.segment.compare_exchange_strong(mapped, SIZE_MAX)) {
+				const off_t start = static_cast<off_t>(segment * file.segment_size);
+				char* data = nullptr;
+				if (posix_fallocate(file.fd, start, static_cast<off_t>(file.segment_size)) == 0) {
+					void* mapping = mmap(nullptr, file.segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, file.fd, start);
+					data = mapping == MAP_FAILED ? nullptr : static_cast<char*>(mapping);
+				}
+				slot.data.store(data, std::memory_order_relaxed);
+				slot.committed.store(0, std::memory_order_relaxed);
+				slot.segment.store(segment + 1, std::memory_order_release);
+				return data;
 			}
+			std::this_thread::yield(); // The slot still holds an older segment that is being written.
 		}
-		s_callbacks.clear();
-		on_callback_change();
 	}
 
-	// Returns the maximum of g_stderr_verbosity and all file/custom outputs.
-	Verbosity current_verbosity_cutoff()
+	static void mapped_commit(MappedFile& file, size_t segment, size_t size)
 	{
-		return g_stderr_verbosity > s_max_out_verbosity ?
-			g_stderr_verbosity : s_max_out_verbosity;
+		MappedSlot& slot = file.slots[segment % MappedFile::NUM_SLOTS];
+		if (slot.committed.fetch_add(size, std::memory_order_acq_rel) + size == file.segment_size) {
+			char* data = slot.data.exchange(nullptr, std::memory_order_relaxed);
+			if (data) { munmap(data, file.segment_size); } // The kernel writes back the pages.
+			slot.segment.store(0, std::memory_order_release);
+		}
 	}
 
-	void set_thread_name(const char* name)
+	// Called by each logging thread before anything else, so the line is in the page cache even if we crash right after.
+	// Without indentation: that is kept under s_mutex.
+	static void mapped_file_write(const Message& message, Preambles& preambles, bool with_indentation)
 	{
-#if LOGURU_PTLS_NAMES
-		(void)pthread_once(&s_pthread_key_once, make_pthread_key_name);
-		(void)pthread_setspecific(s_pthread_key_name, strdup(name));
-
-#elif LOGURU_PTHREADS
-#ifdef __APPLE__
-		pthread_setname_np(name);
-#else
-		pthread_setname_np(pthread_self(), name);
-#endif
-#else // LOGURU_PTHREADS
-		(void)name;
-#endif // LOGURU_PTHREADS
+		if (!s_mapped_file.load(std::memory_order_relaxed)) { return; }
+		CallbackReader reader; // Removing the output waits for us before closing the file.
+		const CallbackList* list = reader.list();
+		MappedFile* file = list ? list->mapped_file : nullptr;
+		if (file && output_verbosity(message.verbosity, message.filename) <= file->verbosity) {
+			const char* indent = with_indentation ? indentation(scope_depth(s_scope_depths, file->verbosity)) : "";
+			const char* preamble = preambles.get(Preamble_All);
+			const Chunk chunks[] = {
+				{ preamble,         strlen(preamble)         },
+				{ indent,           strlen(indent)           },
+				{ message.prefix,   strlen(message.prefix)   },
+				{ message.message,  strlen(message.message)  },
+				{ "\n",             1                        },
+			};
+			size_t total = 0;
+			for (const auto& chunk : chunks) { total += chunk.size; }
+
+			size_t offset = file->offset.fetch_add(total, std::memory_order_relaxed);
+			for (const auto& chunk : chunks) {
+				for (size_t done = 0; done < chunk.size; ) {
+					const size_t segment = offset / file->segment_size;
+					const size_t segment_offset = offset % file->segment_size;
+					const size_t size = std::min(chunk.size - done, file->segment_size - segment_offset);
+					if (char* data = mapped_segment(*file, segment)) {
+						memcpy(data + segment_offset, chunk.data + done, size);
+					}
+					mapped_commit(*file, segment, size);
+					done += size;
+					offset += size;
+				}
+			}
+		}
 	}
 
-#if LOGURU_PTLS_NAMES
-	const char* get_thread_name_ptls()
+	static void mapped_file_log(void*, const Message&) { } // Written by mapped_file_write instead.
+
+	static void mapped_file_close(void* user_data)
 	{
-		(void)pthread_once(&s_pthread_key_once, make_pthread_key_name);
-		return static_cast<const char*>(pthread_getspecific(s_pthread_key_name));
+		MappedFile* file = reinterpret_cast<MappedFile*>(user_data);
+		s_mapped_file.store(nullptr);
+		for (auto& slot : file->slots) {
+			if (char* data = slot.data.load()) { munmap(data, file->segment_size); }
+		}
+		if (ftruncate(file->fd, static_cast<off_t>(file->offset.load())) != 0) {
+			fprintf(stderr, "Loguru: failed to trim the preallocated end of a mapped log file\n");
+		}
+		close(file->fd);
+		delete file;
 	}
-#endif // LOGURU_PTLS_NAMES
 
-	void get_thread_name(char* buffer, unsigned long long length, bool right_align_hext_id)
+	bool add_mapped_file(const char* path_in, FileMode mode, Verbosity verbosity, size_t segment_size)
 	{
-		CHECK_NE_F(length, 0u, "Zero length buffer in get_thread_name");
-		CHECK_NOTNULL_F(buffer, "nullptr in get_thread_name");
-#if LOGURU_PTHREADS
-		auto thread = pthread_self();
-#if LOGURU_PTLS_NAMES
-		if (const char* name = get_thread_name_ptls()) {
-			snprintf(buffer, length, "%s", name);
+		char path[PATH_MAX];
+		if (!expand_home(path_in, path)) { return false; }
+
+		if (!mkpath(path)) {
+			LOG_F(ERROR, "Failed to create directories to '%s'", path);
 		}
-		else {
-			buffer[0] = 0;
+
+		const int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC | (mode == FileMode::Truncate ? O_TRUNC : 0), 0644);
+		if (fd < 0) {
+			LOG_F(ERROR, "Failed to open '%s'", path);
+			return false;
 		}
-#else
-		pthread_getname_np(thread, buffer, length);
-#endif
 
-		if (buffer[0] == 0) {
-#ifdef __APPLE__
-			uint64_t thread_id;
-			pthread_threadid_np(thread, &thread_id);
-#else
-			uint64_t thread_id = thread;
-#endif
-			if (right_align_hext_id) {
-				snprintf(buffer, length, "%*X", length - 1, static_cast<unsigned>(thread_id));
-			}
-			else {
-				snprintf(buffer, length, "%X", static_cast<unsigned>(thread_id));
-			}
+		const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		auto file = new MappedFile();
+		file->fd = fd;
+		file->verbosity = verbosity;
+		file->segment_size = std::max(page_size, (segment_size + page_size - 1) / page_size * page_size);
+		const off_t existing_size = lseek(fd, 0, SEEK_END);
+		file->offset = existing_size > 0 ? static_cast<size_t>(existing_size) : 0;
+		if (const size_t head = file->offset % file->segment_size) {
+			// When appending, count what is already in the first segment as written, so it gets unmapped when full.
+			const size_t segment = file->offset / file->segment_size;
+			mapped_segment(*file, segment);
+			mapped_commit(*file, segment, head);
 		}
-#else // LOGURU_PTHREADS
-		buffer[0] = 0;
-#endif // LOGURU_PTHREADS
 
+		MappedFile* expected = nullptr;
+		if (!s_mapped_file.compare_exchange_strong(expected, file)) {
+			close(fd);
+			delete file;
+			LOG_F(ERROR, "Only one mapped log file is supported at a time");
+			return false;
+		}
+		// For the verbosity cutoff, remove_callback(path) and shutdown().
+		add_callback(path_in, mapped_file_log, file, verbosity, mapped_file_close, nullptr);
+		return true;
 	}
+#else // !__linux__
+	static void mapped_file_write(const Message&, Preambles&, bool) { }
+	static void mapped_file_log(void*, const Message&) { }
 
-	// ------------------------------------------------------------------------
-	// Stack traces
-
-#if LOGURU_STACKTRACES
-	Text demangle(const char* name)
+	bool add_mapped_file(const char* path, FileMode, Verbosity, size_t)
 	{
-		int status = -1;
-		char* demangled = abi::__cxa_demangle(name, 0, 0, &status);
-		Text result{ status == 0 ? demangled : strdup(name) };
-		return result;
+		LOG_F(ERROR, "Can't log to '%s': add_mapped_file is only supported on Linux", path);
+		return false;
 	}
+#endif // !__linux__
 
-	template <class T>
-	std::string type_name() {
-		auto demangled = demangle(typeid(T).name());
-		return demangled.c_str();
-	}
+	// ------------------------------------------------------------------------
+	// Compressed file (add_compressed_file):
+	// Lines are gathered until frame_size bytes, flush() or close, then compressed into one frame and appended.
+	// Runs wherever callbacks run, i.e. on the writer thread in async mode.
 
-	static const StringPairList REPLACE_LIST = {
-		{ type_name<std::string>(),    "std::string" },
-		{ type_name<std::wstring>(),   "std::wstring" },
-		{ type_name<std::u16string>(), "std::u16string" },
-		{ type_name<std::u32string>(), "std::u32string" },
-		{ "std::__1::",                "std::" },
-		{ "__thiscall ",               "" },
-		{ "__cdecl ",                  "" },
+	struct CompressedFile
+	{
+		FILE*             file;
+		Compressor        compressor;
+		size_t            frame_size;
+		std::vector<char> lines;
+		std::vector<char> frame;
 	};
 
-	void do_replacements(const StringPairList& replacements, std::string& str)
+	static void compressed_file_write_frame(CompressedFile& file)
 	{
-		for (auto&& p : replacements) {
-			if (p.first.size() <= p.second.size()) {
-				// On gcc, "type_name<std::string>()" is "std::string"
-				continue;
-			}
-
-			size_t it;
-			while ((it = str.find(p.first)) != std::string::npos) {
-				str.replace(it, p.first.size(), p.second);
-			}
+		if (file.lines.empty()) { return; }
+		const Compressor& compressor = file.compressor;
+		file.frame.resize(compressor.bound(compressor.user_data, file.lines.size()));
+		const size_t frame_size = compressor.compress(compressor.user_data,
+			file.lines.data(), file.lines.size(), file.frame.data(), file.frame.size());
+		if (frame_size == 0) {
+			// No LOG_F here: we are in the middle of writing a message.
+			fprintf(stderr, "Loguru: failed to compress %u bytes of log\n", static_cast<unsigned>(file.lines.size()));
+		} else {
+			fwrite(file.frame.data(), 1, frame_size, file.file);
+			fflush(file.file);
 		}
+		file.lines.clear();
 	}
 
-	std::string prettify_stacktrace(const std::string& input)
+	static void compressed_file_log(void* user_data, const Message& message)
 	{
-		std::string output = input;
-
-		do_replacements(s_user_stack_cleanups, output);
-		do_replacements(REPLACE_LIST, output);
-
-		try {
-			std::regex std_allocator_re(R"(,\s*std::allocator<[^<>]+>)");
-			output = std::regex_replace(output, std_allocator_re, std::string(""));
-
-			std::regex template_spaces_re(R"(<\s*([^<> ]+)\s*>)");
-			output = std::regex_replace(output, template_spaces_re, std::string("<$1>"));
+		CompressedFile& file = *reinterpret_cast<CompressedFile*>(user_data);
+		for (const char* part : { message.preamble, message.indentation, message.prefix, message.message }) {
+			file.lines.insert(file.lines.end(), part, part + strlen(part));
 		}
-		catch (std::regex_error&) {
-			// Probably old GCC.
+		file.lines.push_back('\n');
+		if (file.lines.size() >= file.frame_size) {
+			compressed_file_write_frame(file);
 		}
+	}
 
-		return output;
+	static void compressed_file_close(void* user_data)
+	{
+		CompressedFile* file = reinterpret_cast<CompressedFile*>(user_data);
+		compressed_file_write_frame(*file);
+		fclose(file->file);
+		delete file;
 	}
 
-	std::string stacktrace_as_stdstring(int skip)
+	// Only on flush() and by the flusher: flushing after every line would give one tiny frame per line.
+	static void compressed_file_flush(void* user_data)
 	{
-		// From https://gist.github.com/fmela/591333
-		void* callstack[128];
-		const auto max_frames = sizeof(callstack) / sizeof(callstack[0]);
-		int num_frames = backtrace(callstack, max_frames);
-		char** symbols = backtrace_symbols(callstack, num_frames);
+		compressed_file_write_frame(*reinterpret_cast<CompressedFile*>(user_data));
+	}
 
-		std::string result;
-		// Print stack traces so the most relevant ones are written last
-		// Rationale: http://yellerapp.com/posts/2015-01-22-upside-down-stacktraces.html
-		for (int i = num_frames - 1; i >= skip; --i) {
-			char buf[1024];
-			Dl_info info;
-			if (dladdr(callstack[i], &info) && info.dli_sname) {
-				char* demangled = NULL;
-				int status = -1;
-				if (info.dli_sname[0] == '_') {
-					demangled = abi::__cxa_demangle(info.dli_sname, 0, 0, &status);
-				}
-				snprintf(buf, sizeof(buf), "%-3d %*p %s + %zd\n",
-					i - skip, int(2 + sizeof(void*) * 2), callstack[i],
-					status == 0 ? demangled :
-					info.dli_sname == 0 ? symbols[i] : info.dli_sname,
-					static_cast<char*>(callstack[i]) - static_cast<char*>(info.dli_saddr));
-				free(demangled);
-			}
-			else {
-				snprintf(buf, sizeof(buf), "%-3d %*p %s\n",
-					i - skip, int(2 + sizeof(void*) * 2), callstack[i], symbols[i]);
-			}
-			result += buf;
-		}
-		free(symbols);
+	static void add_callback_with_flush(const char* id, log_handler_t callback, void* user_data, Verbosity verbosity,
+		close_handler_t on_close, flush_handler_t on_flush, bool thread_safe, std::shared_ptr<SinkFlush> flush_state,
+		unsigned preamble_fields);
 
-		if (num_frames == max_frames) {
-			result = "[truncated]\n" + result;
+	bool add_compressed_file(const char* path_in, FileMode mode, Verbosity verbosity,
+		const Compressor& compressor, size_t frame_size)
+	{
+		char path[PATH_MAX];
+		if (!expand_home(path_in, path)) { return false; }
+
+		if (!mkpath(path)) {
+			LOG_F(ERROR, "Failed to create directories to '%s'", path);
 		}
 
-		if (!result.empty() && result[result.size() - 1] == '\n') {
-			result.resize(result.size() - 1);
+		FILE* file = open_log_file(path, mode == FileMode::Truncate ? "wb" : "ab");
+		if (!file) {
+			LOG_F(ERROR, "Failed to open '%s'", path);
+			return false;
 		}
 
-		return prettify_stacktrace(result);
+		auto compressed_file = new CompressedFile{ file, compressor, std::max<size_t>(frame_size, 1), {}, {} };
+		compressed_file->lines.reserve(compressed_file->frame_size + 1024);
+		auto flush_state = std::make_shared<SinkFlush>();
+		flush_state->batches = true;
+		add_callback_with_flush(path_in, compressed_file_log, compressed_file, verbosity,
+			compressed_file_close, compressed_file_flush, false, std::move(flush_state), Preamble_All);
+		return true;
 	}
 
-#else // LOGURU_STACKTRACES
-	Text demangle(const char* name)
+#if LOGURU_WITH_ZSTD
+	static size_t zstd_compress(void* user_data, const void* in, size_t size, void* out, size_t out_capacity)
 	{
-		return Text(_strdup(name));
+		const int level = static_cast<int>(reinterpret_cast<intptr_t>(user_data));
+		const size_t result = ZSTD_compress(out, out_capacity, in, size, level);
+		return ZSTD_isError(result) ? 0 : result;
 	}
 
-	std::string stacktrace_as_stdstring(int)
+	static size_t zstd_bound(void*, size_t size) { return ZSTD_compressBound(size); }
+
+	Compressor zstd_compressor(int level)
 	{
-		//#warning "Loguru: No stacktraces available on this platform"
-		//include stackwalker here
-		//StackWalkerToConsole sw;
-		//sw.ShowCallstack();
-		return "";
+		return Compressor{ zstd_compress, zstd_bound, reinterpret_cast<void*>(static_cast<intptr_t>(level)) };
 	}
+#endif // LOGURU_WITH_ZSTD
 
-#endif // LOGURU_STACKTRACES
+#if LOGURU_WITH_LZ4
+	static size_t lz4_compress(void*, const void* in, size_t size, void* out, size_t out_capacity)
+	{
+		const size_t result = LZ4F_compressFrame(out, out_capacity, in, size, nullptr);
+		return LZ4F_isError(result) ? 0 : result;
+	}
 
-	Text stacktrace(int skip)
+	static size_t lz4_bound(void*, size_t size) { return LZ4F_compressFrameBound(size, nullptr); }
+
+	Compressor lz4_compressor()
 	{
-		auto str = stacktrace_as_stdstring(skip + 1);
-		return Text(_strdup(str.c_str()));
+		return Compressor{ lz4_compress, lz4_bound, nullptr };
 	}
+#endif // LOGURU_WITH_LZ4
 
 	// ------------------------------------------------------------------------
+	// Structured logging (LOG_KV, add_structured_file):
 
-  // modify
-  static void print_preamble(char* out_buff, size_t out_buff_size, Verbosity verbosity, const char* file, unsigned line)
-  {
-    long long ms_since_epoch = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
-    time_t sec_since_epoch = time_t(ms_since_epoch / 1000);
-#ifdef _MSC_VER
-    //tm  *time_info = localtime(&sec_since_epoch);
-    tm  time_info;
-    localtime_s(&time_info, &sec_since_epoch);
-#else
-    tm time_info;
-#ifdef __BORLANDC__
-    localtime_s(&sec_since_epoch, &time_info);
-#else
-    localtime_r(&sec_since_epoch, &time_info);
-#endif
-#endif
-
-    auto uptime_ms = duration_cast<milliseconds>(steady_clock::now() - s_start_time).count();
-    auto uptime_sec = uptime_ms / 1000.0;
+	template <typename Out>
+	static void append_json_string(Out& out, const char* str)
+	{
+		out += '"';
+		for (const char* run = str; ; ++str) {
+			const unsigned char c = static_cast<unsigned char>(*str);
+			if (c >= 0x20 && c != '"' && c != '\\') { continue; }
+			out.append(run, str);  // Copy runs of plain characters in one go.
+			if (c == 0) { break; }
+			switch (c) {
+				case '"':  out += "\\\""; break;
+				case '\\': out += "\\\\"; break;
+				case '\n': out += "\\n";  break;
+				case '\r': out += "\\r";  break;
+				case '\t': out += "\\t";  break;
+				default:   out += "\\u00"; write_hex_byte(out, c); break;
+			}
+			run = str + 1;
+		}
+		out += '"';
+	}
 
-    char thread_name[THREAD_NAME_WIDTH + 1] = { 0 };
-    get_thread_name(thread_name, THREAD_NAME_WIDTH + 1, true);
+	// Quoted (like JSON) only if needed.
+	template <typename Out>
+	static void append_logfmt_string(Out& out, const char* str)
+	{
+		for (const char* p = str; ; ++p) {
+			const unsigned char c = static_cast<unsigned char>(*p);
+			if (c == 0) {
+				if (p != str) {
+					out += str;
+					return;
+				}
+				break;
+			}
+			if (c <= ' ' || c == '=' || c == '"' || c == '\\') { break; }
+		}
+		append_json_string(out, str);
+	}
 
-    if (s_strip_file_path) {
-      file = filename(file);
-    }
+	// Out is a std::string or a TextBuffer.
+	template <typename Out>
+	static void append_field_value(Out& out, const Field& field, StructuredFormat format)
+	{
+		char buff[32];
+		switch (field.type) {
+			case Field_Int:
+				snprintf(buff, sizeof(buff), "%lld", field.value.i);
+				out += buff;
+				break;
+			case Field_UInt:
+				snprintf(buff, sizeof(buff), "%llu", field.value.u);
+				out += buff;
+				break;
+			case Field_Double:
+				if (format == Format_JsonLines && !std::isfinite(field.value.d)) {
+					out += "null";
+				} else {
+					snprintf(buff, sizeof(buff), "%.15g", field.value.d);
+					out += buff;
+				}
+				break;
+			case Field_Bool:
+				out += field.value.b ? "true" : "false";
+				break;
+			case Field_String:
+				if (format == Format_JsonLines) {
+					append_json_string(out, field.value.s);
+				} else {
+					append_logfmt_string(out, field.value.s);
+				}
+				break;
+		}
+	}
 
-    char level_buff[6];
-    if (verbosity <= Verbosity_FATAL) {
-      snprintf(level_buff, sizeof(level_buff) - 1, " F\t");
-    }
-    else if (verbosity == Verbosity_ERROR) {
-      snprintf(level_buff, sizeof(level_buff) - 1, " E\t");
-    }
-    else if (verbosity == Verbosity_WARNING) {
-      snprintf(level_buff, sizeof(level_buff) - 1, " W\t");
-    }
-    else if (verbosity == Verbosity_INFO) {
-      snprintf(level_buff, sizeof(level_buff) - 1, " I\t");
-    }
-    else {
-      //snprintf(level_buff, sizeof(level_buff) - 1, "% 4d", verbosity);
-    }
+	struct StructuredFile
+	{
+		FileSink*        sink;
+		StructuredFormat format;
+		std::string      line; // Reused, to save allocations.
+	};
 
-#ifdef _MSC_VER
-    if (time_off)
-    {
-      if (name_on == true)
-        snprintf(out_buff, out_buff_size, "(%8.3fs) [%s]%20s:%-5u ",
-          uptime_sec,
-          level_buff,
-          file, line);
-      else
-        snprintf(out_buff, out_buff_size, "(%8.3fs) [%s] ",
-          uptime_sec,
-          level_buff);
-    }
-    else
-    {
-      snprintf(out_buff, out_buff_size, "%04d-%02d-%02d %02d:%02d:%02d.%03lld (%8.3fs) [%-*s]%23s:%-5u %4s| ",
-        1900 + time_info.tm_year, 1 + time_info.tm_mon, time_info.tm_mday,
-        time_info.tm_hour, time_info.tm_min, time_info.tm_sec, ms_since_epoch % 1000,
-        uptime_sec,
-        THREAD_NAME_WIDTH, thread_name,
-        file, line, level_buff);
-    }
-#else
-		snprintf(out_buff, out_buff_size, "%04d-%02d-%02d %02d:%02d:%02d.%03lld (%8.3fs) [%-*s]%23s:%-5u %4s| ",
-			1900 + time_info.tm_year, 1 + time_info.tm_mon, time_info.tm_mday,
-			time_info.tm_hour, time_info.tm_min, time_info.tm_sec, ms_since_epoch % 1000,
-			uptime_sec,
-			THREAD_NAME_WIDTH, thread_name,
-			file, line, level_buff);
-#endif
+	static const char* level_name(Verbosity verbosity, char (&buff)[12])
+	{
+		if (verbosity <= Verbosity_FATAL)   { return "FATAL"; }
+		if (verbosity == Verbosity_ERROR)   { return "ERROR"; }
+		if (verbosity == Verbosity_WARNING) { return "WARNING"; }
+		if (verbosity == Verbosity_INFO)    { return "INFO"; }
+		snprintf(buff, sizeof(buff), "%d", static_cast<int>(verbosity));
+		return buff;
 	}
 
-	// stack_trace_skip is just if verbosity == FATAL.
-	static void log_message(int stack_trace_skip, Message& message, bool with_indentation, bool abort_if_fatal)
+	static void structured_file_log(void* user_data, const Message& message)
 	{
-		const auto verbosity = message.verbosity;
-		std::lock_guard<std::recursive_mutex> lock(s_mutex);
-
-		if (message.verbosity == Verbosity_FATAL) {
-			auto st = loguru::stacktrace(stack_trace_skip + 2);
-			if (!st.empty()) {
-				RAW_LOG_F(ERROR, "Stack trace:\n%s", st.c_str());
+		StructuredFile& file = *reinterpret_cast<StructuredFile*>(user_data);
+		const bool json = file.format == Format_JsonLines;
+		std::string& out = file.line;
+		out.clear();
+
+		auto add_key = [&](const char* key) {
+			if (json) {
+				out += out.empty() ? '{' : ',';
+				append_json_string(out, key);
+				out += ':';
+			} else {
+				if (!out.empty()) { out += ' '; }
+				out += key;
+				out += '=';
 			}
+		};
+		auto add_string = [&](const char* key, const char* value) {
+			add_key(key);
+			if (json) { append_json_string(out, value); } else { append_logfmt_string(out, value); }
+		};
 
-			auto ec = loguru::get_error_context();
-			if (!ec.empty()) {
-				RAW_LOG_F(ERROR, "%s", ec.c_str());
+		const long long ms_since_epoch = message.ms_since_epoch; // The same time as in the text preamble.
+		const time_t sec_since_epoch = time_t(ms_since_epoch / 1000);
+		tm time_info;
+#ifdef _WIN32
+		gmtime_s(&time_info, &sec_since_epoch);
+#else
+		gmtime_r(&sec_since_epoch, &time_info);
+#endif
+		char time_buff[6 * 11 + 20 + 8]; // "YYYY-MM-DDThh:mm:ss.sssZ", with room for any value in each field.
+		snprintf(time_buff, sizeof(time_buff), "%04d-%02d-%02dT%02d:%02d:%02d.%03lldZ",
+			1900 + time_info.tm_year, 1 + time_info.tm_mon, time_info.tm_mday,
+			time_info.tm_hour, time_info.tm_min, time_info.tm_sec, ms_since_epoch % 1000);
+		add_string("time", time_buff);
+
+		char level_buff[12]; // Room for any int.
+		add_string("level", level_name(message.verbosity, level_buff));
+		add_string("file", s_strip_file_path ? filename(message.filename) : message.filename);
+		add_key("line");
+		out += std::to_string(message.line);
+
+		if (message.num_fields > 0) {
+			for (size_t i = 0; i < message.num_fields; ++i) {
+				add_key(message.fields[i].key);
+				append_field_value(out, message.fields[i], file.format);
 			}
+		} else if (message.prefix[0]) {
+			add_string("msg", (std::string(message.prefix) + message.message).c_str());
+		} else {
+			add_string("msg", message.message);
 		}
+		out += json ? "}\n" : "\n";
 
-		if (with_indentation) {
-			message.indentation = indentation(s_stderr_indentation);
-		}
+		const Chunk chunk = { out.data(), out.size() };
+		file_sink_append(*file.sink, &chunk, 1, message.verbosity <= Verbosity_ERROR);
+	}
 
-		if (verbosity <= g_stderr_verbosity) {
-			if (g_colorlogtostderr && s_terminal_has_color) {
-				if (verbosity > Verbosity_WARNING) {
-#if _MSC_VER
-          SetConsoleTextAttribute(hConsole, 8);
-#endif
-					fprintf(stderr, "%s%s%s%s%s%s%s%s%s\n",
-						terminal_reset(),
-						terminal_dim(),
-						message.preamble,
-						message.indentation,
-						terminal_reset(),
-						verbosity == Verbosity_INFO ? terminal_bold() : terminal_light_gray(),
-						message.prefix,
-						message.message,
-						terminal_reset());
-				}
-				else {
-          switch (verbosity)
-          {
-          case Verbosity_WARNING:
-#if _MSC_VER
-            SetConsoleTextAttribute(hConsole, 14);
-#endif
-            break;
-          case Verbosity_ERROR:
-#if _MSC_VER
-            SetConsoleTextAttribute(hConsole, 12);
-#endif
-            break;
-          case Verbosity_FATAL:
-#if _MSC_VER
-            SetConsoleTextAttribute(hConsole, 12);
+	static void structured_file_close(void* user_data)
+	{
+		StructuredFile* file = reinterpret_cast<StructuredFile*>(user_data);
+		file_close(file->sink);
+		delete file;
+	}
+
+	static void structured_file_flush(void* user_data)
+	{
+		file_flush(reinterpret_cast<StructuredFile*>(user_data)->sink);
+	}
+
+	bool add_structured_file(const char* path_in, FileMode mode, Verbosity verbosity, StructuredFormat format)
+	{
+		FileSink* sink = open_file_sink(path_in, mode, FileRotation{ 0, Rotation_None, 0 });
+		if (!sink) { return false; }
+		auto file = new StructuredFile{ sink, format, std::string() };
+		add_callback_with_flush(path_in, structured_file_log, file, verbosity, structured_file_close, structured_file_flush,
+			false, std::make_shared<SinkFlush>(), Preamble_None); // It has its own time and level.
+		return true;
+	}
+
+	// ------------------------------------------------------------------------
+	// Network sinks (add_network_sink, add_journald):
+	// Callbacks like the others. add_network_sink only queues the lines: the flusher thread sends them.
+	// Sockets are non-blocking: lines that can't be sent yet are kept, up to LOGURU_NETWORK_BUFFER_SIZE bytes.
+
+	static bool mark_dirty(SinkFlush& state);
+	static void flush_soon(SinkFlush& state);
+
+#ifndef _WIN32
+	const size_t    NETWORK_DATAGRAM_SIZE  = 1400;      // Fits in one Ethernet frame.
+	const size_t    NETWORK_BATCH_SIZE     = 16 * 1024; // Sent without waiting for the flush interval.
+	const long long NETWORK_MIN_BACKOFF_NS = 100 * 1000000LL;
+	const long long NETWORK_MAX_BACKOFF_NS = 30 * 1000000000LL;
+
+#ifdef MSG_NOSIGNAL
+	const int NETWORK_SEND_FLAGS = MSG_NOSIGNAL; // A closed TCP connection must not raise SIGPIPE.
+#else
+	const int NETWORK_SEND_FLAGS = 0;            // SO_NOSIGPIPE is set on the socket instead.
 #endif
-            break;
-          default:
-            break;
-          }
-					fprintf(stderr, "%s%s%s%s%s%s%s%s\n",
-						terminal_reset(),
-						terminal_bold(),
-						verbosity == Verbosity_WARNING ? terminal_red() : terminal_light_red(),
-						message.preamble,
-						message.indentation,
-						message.prefix,
-						message.message,
-						terminal_reset());
-				}
+
+	struct NetworkSink
+	{
+		std::string                id;
+		NetworkProtocol            protocol;
+		sockaddr_storage           address;
+		socklen_t                  address_size;
+		int                        fd;              // -1 while disconnected.
+		bool                       connecting;      // Waiting for a TCP connect.
+		bool                       failing;         // The last error has been reported.
+		bool                       partial_line;    // The start of 'pending' is the rest of a line partly sent.
+		std::string                pending;         // Lines not sent yet, from pending_start on.
+		size_t                     pending_start;   // What is before it has been sent.
+		size_t                     num_dropped;
+		long long                  backoff_ns;
+		long long                  next_connect_ns; // now_ns() before which we don't reconnect.
+		std::shared_ptr<SinkFlush> flush_state;     // To retry when nothing else is logged. Null when closing.
+	};
+
+	static void network_fail(NetworkSink& sink, const char* what, int error)
+	{
+		if (!sink.failing) {
+			// No LOG_F here: we are in the middle of writing a message.
+			fprintf(stderr, "Loguru: %s to %s failed: %s\n", what, sink.id.c_str(), strerror(error));
+			sink.failing = true;
+		}
+		if (sink.fd >= 0) { close(sink.fd); }
+		sink.fd = -1;
+		sink.connecting = false;
+		sink.next_connect_ns = now_ns() + sink.backoff_ns;
+		sink.backoff_ns = std::min(sink.backoff_ns * 2, NETWORK_MAX_BACKOFF_NS);
+		if (sink.partial_line) {
+			// The next connection starts with a new line.
+			const size_t end = sink.pending.find('\n', sink.pending_start);
+			sink.pending_start = end == std::string::npos ? sink.pending.size() : end + 1;
+			sink.partial_line = false;
+		}
+	}
+
+	// Forgets what has been sent. Unless that is all of it, only once it is half the buffer,
+	// so that each partial send does not move the rest of the lines.
+	static void network_compact(NetworkSink& sink)
+	{
+		if (sink.pending_start == sink.pending.size() || sink.pending_start >= LOGURU_NETWORK_BUFFER_SIZE / 2) {
+			sink.pending.erase(0, sink.pending_start);
+			sink.pending_start = 0;
+		}
+	}
+
+	// Returns true if the socket is connected (or once a TCP connect has completed).
+	static bool network_ready(NetworkSink& sink)
+	{
+		if (sink.fd < 0) {
+			if (now_ns() < sink.next_connect_ns) { return false; }
+			sink.fd = socket(sink.address.ss_family, sink.protocol == Network_Tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+			if (sink.fd < 0) {
+				network_fail(sink, "socket", errno);
+				return false;
 			}
-			else {
-#if _MSC_VER
-        SetConsoleTextAttribute(hConsole, 8);
+			fcntl(sink.fd, F_SETFD, FD_CLOEXEC);
+			fcntl(sink.fd, F_SETFL, fcntl(sink.fd, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+			int one = 1;
+			setsockopt(sink.fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
 #endif
-				fprintf(stderr, "%s%s%s%s\n",
-					message.preamble, message.indentation, message.prefix, message.message);
+			if (connect(sink.fd, reinterpret_cast<const sockaddr*>(&sink.address), sink.address_size) != 0) {
+				if (errno != EINPROGRESS) {
+					network_fail(sink, "connect", errno);
+					return false;
+				}
+				sink.connecting = true;
+			}
+		}
+		if (sink.connecting) {
+			pollfd poll_fd = { sink.fd, POLLOUT, 0 };
+			if (poll(&poll_fd, 1, 0) <= 0) { return false; }
+			int error = 0;
+			socklen_t error_size = sizeof(error);
+			getsockopt(sink.fd, SOL_SOCKET, SO_ERROR, &error, &error_size);
+			if (error != 0) {
+				network_fail(sink, "connect", error);
+				return false;
 			}
+			sink.connecting = false;
+		}
+		return true;
+	}
 
-			if (g_flush_interval_ms == 0) {
-				fflush(stderr);
+	// Sends as much of the pending lines as the socket takes without blocking.
+	static void network_send(NetworkSink& sink)
+	{
+		if (sink.pending_start < sink.pending.size() && network_ready(sink)) {
+			size_t sent = sink.pending_start;
+			while (sent < sink.pending.size()) {
+				size_t size = sink.pending.size() - sent;
+				if (sink.protocol == Network_Udp && size > NETWORK_DATAGRAM_SIZE) {
+					// Whole lines, unless a single line is longer than a datagram.
+					const size_t end = sink.pending.rfind('\n', sent + NETWORK_DATAGRAM_SIZE - 1);
+					size = end != std::string::npos && end >= sent ? end + 1 - sent : NETWORK_DATAGRAM_SIZE;
+				}
+				const ssize_t result = send(sink.fd, sink.pending.data() + sent, size, NETWORK_SEND_FLAGS);
+				if (result < 0) {
+					if (errno == EINTR) { continue; }
+					if (errno != EAGAIN && errno != EWOULDBLOCK) {
+						sink.partial_line = sent > sink.pending_start ? sink.pending[sent - 1] != '\n' : sink.partial_line;
+						sink.pending_start = sent;
+						network_fail(sink, "send", errno);
+						sent = sink.pending_start;
+					}
+					break;
+				}
+				sent += static_cast<size_t>(result);
+				sink.failing = false;
+				sink.backoff_ns = NETWORK_MIN_BACKOFF_NS;
 			}
-			else {
-				s_needs_flushing = true;
+			if (sent > sink.pending_start) {
+				sink.partial_line = sink.pending[sent - 1] != '\n';
+				sink.pending_start = sent;
+			}
+			network_compact(sink);
+			if (sink.pending.empty() && sink.num_dropped > 0) {
+				char line[128];
+				snprintf(line, sizeof(line), "Loguru: dropped %llu lines that could not be sent to %s\n",
+					static_cast<unsigned long long>(sink.num_dropped), sink.id.c_str());
+				sink.pending = line;
+				sink.num_dropped = 0;
+				network_send(sink);
+			}
+		}
+		if (sink.pending_start < sink.pending.size() && sink.flush_state) {
+			mark_dirty(*sink.flush_state); // Try again after the flush interval.
+		}
+	}
+
+	static void network_log(void* user_data, const Message& message)
+	{
+		NetworkSink& sink = *reinterpret_cast<NetworkSink*>(user_data);
+		size_t size = 1;
+		for (const char* part : { message.preamble, message.indentation, message.prefix, message.message }) {
+			size += strlen(part);
+		}
+		if (sink.pending.size() - sink.pending_start + size > LOGURU_NETWORK_BUFFER_SIZE) {
+			sink.pending.erase(0, sink.pending_start);
+			sink.pending_start = 0;
+			// Drop the oldest whole lines, but not the rest of a line partly sent on a TCP connection.
+			const size_t keep = sink.partial_line ? sink.pending.find('\n') + 1 : 0;
+			size_t end = keep;
+			while (end < sink.pending.size() && sink.pending.size() - (end - keep) + size > LOGURU_NETWORK_BUFFER_SIZE) {
+				end = sink.pending.find('\n', end) + 1;
+				++sink.num_dropped;
+				s_stats.sink_dropped.fetch_add(1, std::memory_order_relaxed);
+			}
+			sink.pending.erase(keep, end - keep);
+			if (sink.pending.size() + size > LOGURU_NETWORK_BUFFER_SIZE) {
+				++sink.num_dropped; // Too long for the buffer on its own.
+				s_stats.sink_dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+		}
+		for (const char* part : { message.preamble, message.indentation, message.prefix, message.message }) {
+			sink.pending += part;
+		}
+		sink.pending += '\n';
+		if (sink.pending.size() - sink.pending_start >= NETWORK_BATCH_SIZE || message.verbosity <= Verbosity_ERROR) {
+			flush_soon(*sink.flush_state); // Sent by the flusher thread, not this one.
+		}
+	}
+
+	static void network_flush(void* user_data)
+	{
+		network_send(*reinterpret_cast<NetworkSink*>(user_data));
+	}
+
+	static void network_close(void* user_data)
+	{
+		NetworkSink* sink = reinterpret_cast<NetworkSink*>(user_data);
+		sink->flush_state.reset();
+		sink->next_connect_ns = 0;
+		network_send(*sink); // Last try, without blocking.
+		if (sink->fd >= 0) { close(sink->fd); }
+		delete sink;
+	}
+
+	bool add_network_sink(const char* host, unsigned port, NetworkProtocol protocol, Verbosity verbosity)
+	{
+		char id[512];
+		snprintf(id, sizeof(id), "%s://%s:%u", protocol == Network_Tcp ? "tcp" : "udp", host, port);
+
+		addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = protocol == Network_Tcp ? SOCK_STREAM : SOCK_DGRAM;
+		char port_str[16];
+		snprintf(port_str, sizeof(port_str), "%u", port);
+		addrinfo* addresses = nullptr;
+		const int error = getaddrinfo(host, port_str, &hints, &addresses);
+		if (error != 0 || !addresses) {
+			LOG_F(ERROR, "Can't log to '%s': %s", id, gai_strerror(error));
+			return false;
+		}
+
+		auto sink = new NetworkSink();
+		sink->id = id;
+		sink->protocol = protocol;
+		memcpy(&sink->address, addresses->ai_addr, addresses->ai_addrlen);
+		sink->address_size = addresses->ai_addrlen;
+		freeaddrinfo(addresses);
+		sink->fd = -1;
+		sink->connecting = false;
+		sink->failing = false;
+		sink->partial_line = false;
+		sink->pending_start = 0;
+		sink->num_dropped = 0;
+		sink->backoff_ns = NETWORK_MIN_BACKOFF_NS;
+		sink->next_connect_ns = 0;
+		sink->flush_state = std::make_shared<SinkFlush>();
+		sink->flush_state->interval_ms.store(100);
+		sink->flush_state->batches = true;
+		add_callback_with_flush(id, network_log, sink, verbosity, network_close, network_flush, false,
+			sink->flush_state, Preamble_All);
+		return true;
+	}
+#else // _WIN32
+	bool add_network_sink(const char* host, unsigned port, NetworkProtocol, Verbosity)
+	{
+		LOG_F(ERROR, "Can't log to '%s:%u': add_network_sink is not supported on Windows", host, port);
+		return false;
+	}
+#endif // _WIN32
+
+#ifdef __linux__
+	// The native journal protocol: one datagram per entry, with a "KEY=value\n" line per field.
+	// See https://systemd.io/JOURNAL_NATIVE_PROTOCOL/
+	struct Journald
+	{
+		int         fd;
+		sockaddr_un address;
+		std::string entry; // Reused, to save allocations.
+		std::string value;
+		size_t      num_dropped;
+	};
+
+	static void journald_append(std::string& out, const char* key, const char* value, size_t size)
+	{
+		out += key;
+		if (memchr(value, '\n', size)) {
+			// Binary form: the key, a newline, the size as 64-bit little endian, then the value.
+			out += '\n';
+			for (int i = 0; i < 8; ++i) {
+				out += static_cast<char>((static_cast<unsigned long long>(size) >> (8 * i)) & 0xff);
+			}
+		} else {
+			out += '=';
+		}
+		out.append(value, size);
+		out += '\n';
+	}
+
+	static void journald_append(std::string& out, const char* key, const char* value)
+	{
+		journald_append(out, key, value, strlen(value));
+	}
+
+	static bool journald_send(Journald& journald)
+	{
+		for (int attempt = 0; attempt < 2; ++attempt) {
+			if (send(journald.fd, journald.entry.data(), journald.entry.size(), MSG_DONTWAIT | MSG_NOSIGNAL) >= 0) {
+				return true;
+			}
+			if (errno != ECONNREFUSED && errno != ENOTCONN) { return false; }
+			// The journal was restarted.
+			connect(journald.fd, reinterpret_cast<const sockaddr*>(&journald.address), sizeof(journald.address));
+		}
+		return false;
+	}
+
+	static void journald_log(void* user_data, const Message& message)
+	{
+		Journald& journald = *reinterpret_cast<Journald*>(user_data);
+		std::string& entry = journald.entry;
+		std::string& value = journald.value;
+
+		value = message.prefix;
+		value += message.message;
+		entry.clear();
+		journald_append(entry, "MESSAGE", value.data(), value.size());
+		const char* priority = message.verbosity <= Verbosity_FATAL ? "2" : message.verbosity == Verbosity_ERROR ? "3"
+			: message.verbosity == Verbosity_WARNING ? "4" : message.verbosity == Verbosity_INFO ? "6" : "7";
+		journald_append(entry, "PRIORITY", priority);
+		journald_append(entry, "CODE_FILE", message.filename);
+		journald_append(entry, "CODE_LINE", std::to_string(message.line).c_str());
+		if (!s_argv0_filename.empty()) {
+			journald_append(entry, "SYSLOG_IDENTIFIER", s_argv0_filename.c_str());
+		}
+
+		for (size_t i = 0; i < message.num_fields; ++i) {
+			const Field& field = message.fields[i];
+			// Journal keys are upper case letters, digits and underscores, starting with a letter.
+			std::string key = isalpha(static_cast<unsigned char>(field.key[0])) ? "" : "KV_";
+			for (const char* p = field.key; *p; ++p) {
+				key += isalnum(static_cast<unsigned char>(*p)) ? static_cast<char>(toupper(static_cast<unsigned char>(*p))) : '_';
+			}
+			value.clear();
+			if (field.type == Field_String) {
+				value = field.value.s;
+			} else {
+				append_field_value(value, field, Format_Logfmt);
+			}
+			journald_append(entry, key.c_str(), value.data(), value.size());
+		}
+
+		if (!journald_send(journald)) {
+			++journald.num_dropped;
+			s_stats.sink_dropped.fetch_add(1, std::memory_order_relaxed);
+		} else if (journald.num_dropped > 0) {
+			char text[64];
+			snprintf(text, sizeof(text), "Loguru: dropped %llu messages", static_cast<unsigned long long>(journald.num_dropped));
+			entry.clear();
+			journald_append(entry, "MESSAGE", text);
+			journald_append(entry, "PRIORITY", "4");
+			if (journald_send(journald)) { journald.num_dropped = 0; }
+		}
+	}
+
+	static void journald_close(void* user_data)
+	{
+		Journald* journald = reinterpret_cast<Journald*>(user_data);
+		close(journald->fd);
+		delete journald;
+	}
+
+	bool add_journald(Verbosity verbosity)
+	{
+		sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		snprintf(address.sun_path, sizeof(address.sun_path), "%s", "/run/systemd/journal/socket");
+
+		const int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+		if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+			LOG_F(ERROR, "Can't log to the journal at '%s': %s", address.sun_path, strerror(errno));
+			if (fd >= 0) { close(fd); }
+			return false;
+		}
+
+		auto journald = new Journald{ fd, address, std::string(), std::string(), 0 };
+		add_callback_with_flush("journald", journald_log, journald, verbosity, journald_close, nullptr, false,
+			std::make_shared<SinkFlush>(), Preamble_None); // The journal has its own time.
+		return true;
+	}
+#else // !__linux__
+	bool add_journald(Verbosity)
+	{
+		LOG_F(ERROR, "Can't log to the journal: add_journald is only supported on Linux");
+		return false;
+	}
+#endif // !__linux__
+
+	// Will be called right before abort().
+	void set_fatal_handler(fatal_handler_t handler)
+	{
+		s_fatal_handler = handler;
+	}
+
+	void set_crash_file(const char* path, unsigned num_records)
+	{
+		std::lock_guard<std::recursive_mutex> lock(s_mutex);
+		s_crash_path[0] = '\0';
+		s_crash_num_records = num_records;
+		if (!path) { return; }
+
+		if (!expand_home(path, s_crash_path)) { return; }
+		if (!mkpath(s_crash_path)) {
+			LOG_F(ERROR, "Failed to create directories to '%s'", s_crash_path);
+		}
+	}
+
+	void add_stack_cleanup(const char* find_this, const char* replace_with_this)
+	{
+		if (strlen(find_this) <= strlen(replace_with_this))
+		{
+			LOG_F(WARNING, "add_stack_cleanup: the replacement should be shorter than the pattern!");
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(s_symbol_mutex);
+		s_user_stack_cleanups.push_back(StringPair(find_this, replace_with_this));
+		s_stack_cleanups_changed = true;
+	}
+
+	static void flight_recorder_log(void* user_data, const Message& message);
+
+	// Must be called with s_mutex locked. Returns the old list, which must be deleted after wait_for_callback_readers().
+	static const CallbackList* replace_callbacks(CallbackVec callbacks)
+	{
+		Verbosity max_out_verbosity = Verbosity_OFF;
+		Verbosity max_outputs_verbosity = Verbosity_OFF;
+		bool has_thread_safe = false;
+		MappedFile* mapped_file = nullptr;
+		for (const auto& callback : callbacks)
+		{
+			if (callback.callback == mapped_file_log)
+				mapped_file = static_cast<MappedFile*>(callback.user_data);
+			if (callback.verbosity > max_out_verbosity)
+				max_out_verbosity = callback.verbosity;
+			if (callback.callback != flight_recorder_log && callback.verbosity > max_outputs_verbosity)
+				max_outputs_verbosity = callback.verbosity;
+			has_thread_safe |= callback.thread_safe;
+		}
+		const CallbackList* list = callbacks.empty() ? nullptr : new CallbackList{ std::move(callbacks), has_thread_safe, mapped_file };
+		const CallbackList* old_list = s_callbacks.exchange(list);
+		s_has_thread_safe_callbacks.store(has_thread_safe);
+		s_outputs_verbosity.store(max_outputs_verbosity);
+		set_filter_cutoff(max_out_verbosity);
+		return old_list;
+	}
+
+	static CallbackVec current_callbacks()
+	{
+		const CallbackList* list = s_callbacks.load();
+		return list ? list->callbacks : CallbackVec();
+	}
+
+	static void add_callback_with_flush(const char* id, log_handler_t callback, void* user_data, Verbosity verbosity,
+		close_handler_t on_close, flush_handler_t on_flush, bool thread_safe, std::shared_ptr<SinkFlush> flush_state,
+		unsigned preamble_fields)
+	{
+		std::lock_guard<std::mutex> writer_lock(s_callback_writer_mutex);
+		const CallbackList* old_list;
+		{
+			std::lock_guard<std::recursive_mutex> lock(s_mutex);
+			auto callbacks = current_callbacks();
+			callbacks.push_back(Callback{ id, callback, user_data, verbosity, on_close, on_flush, thread_safe,
+				std::move(flush_state), preamble_fields, std::make_shared<SinkStats>() });
+			old_list = replace_callbacks(std::move(callbacks));
+		}
+		delete_callback_list(old_list);
+	}
+
+	void add_callback(const char* id, log_handler_t callback, void* user_data,
+		Verbosity verbosity, close_handler_t on_close, flush_handler_t on_flush, bool thread_safe)
+	{
+		add_callback_with_flush(id, callback, user_data, verbosity, on_close, on_flush, thread_safe,
+			std::make_shared<SinkFlush>(), Preamble_All);
+	}
+
+	bool remove_callback(const char* id)
+	{
+		if (!outside_callbacks("remove_callback")) { return false; }
+		std::lock_guard<std::mutex> writer_lock(s_callback_writer_mutex);
+		Callback removed;
+		const CallbackList* old_list;
+		{
+			std::lock_guard<std::recursive_mutex> lock(s_mutex);
+			auto callbacks = current_callbacks();
+			auto it = std::find_if(begin(callbacks), end(callbacks), [&](const Callback& c) { return c.id == id; });
+			if (it == callbacks.end()) {
+				LOG_F(ERROR, "Failed to locate callback with id '%s'", id);
+				return false;
 			}
+			removed = *it;
+			callbacks.erase(it);
+			old_list = replace_callbacks(std::move(callbacks));
+		}
+		delete_callback_list(old_list);
+
+		std::lock_guard<std::recursive_mutex> lock(s_mutex);
+		if (removed.close) { removed.close(removed.user_data); }
+		return true;
+	}
+
+	void remove_all_callbacks()
+	{
+		if (!outside_callbacks("remove_all_callbacks")) { return; }
+		std::lock_guard<std::mutex> writer_lock(s_callback_writer_mutex);
+		const CallbackList* old_list;
+		{
+			std::lock_guard<std::recursive_mutex> lock(s_mutex);
+			old_list = replace_callbacks(CallbackVec());
 		}
+		wait_for_callback_readers();
 
-		for (auto& p : s_callbacks) {
-			if (verbosity <= p.verbosity) {
-				if (with_indentation) {
-					message.indentation = indentation(p.indentation);
+		std::lock_guard<std::recursive_mutex> lock(s_mutex);
+		if (old_list) {
+			for (const auto& callback : old_list->callbacks) {
+				if (callback.close) {
+					callback.close(callback.user_data);
 				}
-				p.callback(p.user_data, message);
-				if (g_flush_interval_ms == 0) {
-					if (p.flush) { p.flush(p.user_data); }
+			}
+		}
+		delete_callback_list(old_list);
+	}
+
+	bool set_flush_interval(const char* id, unsigned interval_ms)
+	{
+		std::lock_guard<std::recursive_mutex> lock(s_mutex);
+		if (const CallbackList* list = s_callbacks.load()) {
+			for (const auto& callback : list->callbacks) {
+				if (callback.id == id) {
+					callback.flush_state->interval_ms.store(static_cast<int>(interval_ms));
+					return true;
 				}
-				else {
-					s_needs_flushing = true;
+			}
+		}
+		LOG_F(ERROR, "Failed to locate callback with id '%s'", id);
+		return false;
+	}
+
+	bool set_preamble_fields(const char* id, unsigned fields)
+	{
+		std::lock_guard<std::mutex> writer_lock(s_callback_writer_mutex);
+		const CallbackList* old_list;
+		{
+			std::lock_guard<std::recursive_mutex> lock(s_mutex);
+			auto callbacks = current_callbacks();
+			auto it = std::find_if(begin(callbacks), end(callbacks), [&](const Callback& c) { return c.id == id; });
+			if (it == callbacks.end()) {
+				LOG_F(ERROR, "Failed to locate callback with id '%s'", id);
+				return false;
+			}
+			it->preamble_fields = fields & Preamble_All;
+			old_list = replace_callbacks(std::move(callbacks));
+		}
+		delete_callback_list(old_list);
+		return true;
+	}
+
+	// Returns the maximum of g_stderr_verbosity and all file/custom outputs.
+	Verbosity current_verbosity_cutoff()
+	{
+		const Verbosity max_out_verbosity = static_cast<Verbosity>(
+			((s_filter.load(std::memory_order_relaxed) >> FILTER_CUTOFF_SHIFT) & 0xff) - FILTER_CUTOFF_OFFSET);
+		return g_stderr_verbosity > max_out_verbosity ? g_stderr_verbosity : max_out_verbosity;
+	}
+
+	// ------------------------------------------------------------------------
+	// Per-file verbosity (set_vmodule):
+
+	struct VModuleRule
+	{
+		std::string pattern;
+		Verbosity   verbosity;
+	};
+
+	std::atomic<unsigned> g_vmodule_generation{1}; // 0 is never used, so zero-initialized call sites start out stale.
+
+	// Protected by s_vmodule_mutex, not s_mutex, so a new call site doesn't wait for a slow output.
+	static std::mutex                                 s_vmodule_mutex;
+	static std::vector<VModuleRule>                   s_vmodule_rules;
+	static std::unordered_map<const char*, Verbosity> s_vmodule_file_cutoffs; // __FILE__ -> cutoff, or Verbosity_OFF if no rule.
+
+	// Like fnmatch, with '*' and '?'. '\\' in the path (Windows) matches '/' in the pattern.
+	static bool glob_match(const char* pattern, const char* path, const char* path_end)
+	{
+		for (; *pattern; ++pattern, ++path) {
+			if (*pattern == '*') {
+				for (const char* rest = path; rest <= path_end; ++rest) {
+					if (glob_match(pattern + 1, rest, path_end)) { return true; }
 				}
+				return false;
+			}
+			if (path == path_end) { return false; }
+			const char c = *path == '\\' ? '/' : *path;
+			if (*pattern != '?' && *pattern != c) { return false; }
+		}
+		return path == path_end;
+	}
+
+	static bool vmodule_matches(const std::string& pattern, const char* file)
+	{
+		const char* base = filename(file);
+		const char* end = strrchr(base, '.');
+		if (!end) { end = base + strlen(base); }
+
+		if (pattern.find('/') == std::string::npos) {
+			return glob_match(pattern.c_str(), base, end);
+		}
+		// Try every tail of the path that starts at a directory, so "net/*" matches "/src/net/socket.cpp".
+		for (const char* start = file; start < end; ++start) {
+			if ((start == file || start[-1] == '/' || start[-1] == '\\') && glob_match(pattern.c_str(), start, end)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Verbosity_OFF if no rule matches. Must be called with s_vmodule_mutex locked.
+	static Verbosity vmodule_cutoff(const char* file)
+	{
+		if (s_vmodule_rules.empty()) { return Verbosity_OFF; }
+
+		auto it = s_vmodule_file_cutoffs.find(file);
+		if (it != s_vmodule_file_cutoffs.end()) { return it->second; }
+
+		Verbosity cutoff = Verbosity_OFF;
+		for (const auto& rule : s_vmodule_rules) {
+			if (vmodule_matches(rule.pattern, file)) {
+				cutoff = rule.verbosity;
+				break;
+			}
+		}
+		s_vmodule_file_cutoffs[file] = cutoff;
+		return cutoff;
+	}
+
+	// Per-thread cache of vmodule_cutoff, so verbose messages and scopes don't need s_mutex.
+	struct VModuleCacheEntry
+	{
+		const char* file;
+		unsigned    generation;
+		Verbosity   cutoff;
+	};
+
+	static LOGURU_THREAD_LOCAL VModuleCacheEntry s_vmodule_cache[16];
+
+	// The verbosity the outputs should filter on: messages let through by a rule go wherever INFO goes.
+	static Verbosity output_verbosity(Verbosity verbosity, const char* file)
+	{
+		if (verbosity <= Verbosity_INFO) { return verbosity; }
+		auto& entry = s_vmodule_cache[(reinterpret_cast<uintptr_t>(file) >> 4) % 16];
+		if (entry.file != file || entry.generation != g_vmodule_generation.load(std::memory_order_relaxed)) {
+			std::lock_guard<std::mutex> lock(s_vmodule_mutex);
+			entry = VModuleCacheEntry{ file, g_vmodule_generation.load(), vmodule_cutoff(file) };
+		}
+		const Verbosity cutoff = entry.cutoff;
+		return cutoff != Verbosity_OFF && verbosity <= cutoff ? Verbosity_INFO : verbosity;
+	}
+
+	bool set_vmodule(const char* spec)
+	{
+		std::vector<VModuleRule> rules;
+		for (const char* p = spec; *p; ) {
+			const char* end = strchr(p, ',');
+			if (!end) { end = p + strlen(p); }
+			const char* eq = static_cast<const char*>(memchr(p, '=', static_cast<size_t>(end - p)));
+			char* level_end = nullptr;
+			const long level = eq ? strtol(eq + 1, &level_end, 10) : -1;
+			if (!eq || eq == p || level_end != end || level < 0 || level > Verbosity_MAX) {
+				LOG_F(ERROR, "Invalid vmodule spec '%s'. Expected e.g. 'net/*=3,db=1'", spec);
+				return false;
 			}
+			rules.push_back(VModuleRule{ std::string(p, eq), static_cast<Verbosity>(level) });
+			p = *end ? end + 1 : end;
+		}
+
+		std::lock_guard<std::mutex> lock(s_vmodule_mutex);
+		s_vmodule_rules.swap(rules);
+		s_vmodule_file_cutoffs.clear();
+		unsigned generation = (g_vmodule_generation.load() + 1) & 0xffffff; // Must fit next to the cutoff byte.
+		if (generation == 0) { generation = 1; }
+		g_vmodule_generation.store(generation);
+		return true;
+	}
+
+	Verbosity resolve_site_verbosity_cutoff(std::atomic<unsigned>& site, const char* file)
+	{
+		std::lock_guard<std::mutex> lock(s_vmodule_mutex);
+		const Verbosity cutoff = vmodule_cutoff(file);
+		const unsigned cached_cutoff = cutoff == Verbosity_OFF ? 0 : static_cast<unsigned>(cutoff + 128);
+		site.store((g_vmodule_generation.load() << 8) | cached_cutoff, std::memory_order_relaxed);
+		return cutoff == Verbosity_OFF ? current_verbosity_cutoff() : cutoff;
+	}
+
+	void set_thread_name(const char* name)
+	{
+		s_thread_name_cached = false;
+		s_binary_thread_generation = 0;
+
+#if LOGURU_PTLS_NAMES
+		(void)pthread_once(&s_pthread_key_once, make_pthread_key_name);
+		(void)pthread_setspecific(s_pthread_key_name, strdup(name));
+
+#elif LOGURU_PTHREADS
+#ifdef __APPLE__
+		pthread_setname_np(name);
+#else
+		pthread_setname_np(pthread_self(), name);
+#endif
+#else // LOGURU_PTHREADS
+		(void)name;
+#endif // LOGURU_PTHREADS
+	}
+
+#if LOGURU_PTLS_NAMES
+	const char* get_thread_name_ptls()
+	{
+		(void)pthread_once(&s_pthread_key_once, make_pthread_key_name);
+		return static_cast<const char*>(pthread_getspecific(s_pthread_key_name));
+	}
+#endif // LOGURU_PTLS_NAMES
+
+	void get_thread_name(char* buffer, unsigned long long length, bool right_align_hext_id)
+	{
+		CHECK_NE_F(length, 0u, "Zero length buffer in get_thread_name");
+		CHECK_NOTNULL_F(buffer, "nullptr in get_thread_name");
+#if LOGURU_PTHREADS
+		auto thread = pthread_self();
+#if LOGURU_PTLS_NAMES
+		if (const char* name = get_thread_name_ptls()) {
+			snprintf(buffer, length, "%s", name);
+		}
+		else {
+			buffer[0] = 0;
+		}
+#else
+		pthread_getname_np(thread, buffer, length);
+#endif
+
+		if (buffer[0] == 0) {
+#ifdef __APPLE__
+			uint64_t thread_id;
+			pthread_threadid_np(thread, &thread_id);
+#else
+			uint64_t thread_id = thread;
+#endif
+			if (right_align_hext_id) {
+				snprintf(buffer, length, "%*X", static_cast<int>(length - 1), static_cast<unsigned>(thread_id));
+			}
+			else {
+				snprintf(buffer, length, "%X", static_cast<unsigned>(thread_id));
+			}
+		}
+#else // LOGURU_PTHREADS
+		buffer[0] = 0;
+#endif // LOGURU_PTHREADS
+
+	}
+
+	unsigned get_thread_index()
+	{
+		if (s_thread_index == 0) {
+			s_thread_index = s_num_thread_indices.fetch_add(1, std::memory_order_relaxed) + 1;
+		}
+		return s_thread_index;
+	}
+
+	// ------------------------------------------------------------------------
+	// Stack traces
+
+#if LOGURU_STACKTRACES
+	Text demangle(const char* name)
+	{
+		int status = -1;
+		char* demangled = abi::__cxa_demangle(name, 0, 0, &status);
+		Text result{ status == 0 ? demangled : strdup(name) };
+		return result;
+	}
+
+	template <class T>
+	std::string type_name() {
+		auto demangled = demangle(typeid(T).name());
+		return demangled.c_str();
+	}
+
+	static const StringPairList REPLACE_LIST = {
+		{ type_name<std::string>(),    "std::string" },
+		{ type_name<std::wstring>(),   "std::wstring" },
+		{ type_name<std::u16string>(), "std::u16string" },
+		{ type_name<std::u32string>(), "std::u32string" },
+		{ "std::__1::",                "std::" },
+		{ "__thiscall ",               "" },
+		{ "__cdecl ",                  "" },
+	};
+
+	/* Applies many find/replace rules in a single pass (Aho-Corasick): a trie of the patterns, where each
+	   node also links to the longest proper suffix of it that is in the trie. Where matches overlap,
+	   the leftmost wins, then the longest. */
+	class StackCleaner
+	{
+	public:
+		StackCleaner() : _nodes(1) {}
+
+		void add(const std::string& find_this, const std::string& replace_with_this)
+		{
+			if (find_this.empty() || find_this == replace_with_this) { return; }
+			int node = 0;
+			for (char c : find_this) {
+				int next = child(node, c);
+				if (next < 0) {
+					next = static_cast<int>(_nodes.size());
+					_nodes[node].next.emplace_back(c, next);
+					_nodes.emplace_back();
+				}
+				node = next;
+			}
+			if (_nodes[node].rule < 0) { // Else the first rule for the pattern wins.
+				_nodes[node].rule = static_cast<int>(_rules.size());
+				_rules.emplace_back(find_this, replace_with_this);
+			}
+		}
+
+		// Call after the last add.
+		void link()
+		{
+			std::vector<int> queue; // Breadth first, so the suffixes are linked before the nodes that need them.
+			for (const auto& edge : _nodes[0].next) {
+				queue.push_back(edge.second);
+			}
+			for (size_t i = 0; i < queue.size(); ++i) {
+				const int node = queue[i];
+				for (const auto& edge : _nodes[node].next) {
+					int fail = _nodes[node].fail;
+					while (fail > 0 && child(fail, edge.first) < 0) { fail = _nodes[fail].fail; }
+					Node& next = _nodes[edge.second];
+					next.fail = std::max(child(fail, edge.first), 0);
+					next.output = _nodes[next.fail].rule >= 0 ? next.fail : _nodes[next.fail].output;
+					queue.push_back(edge.second);
+				}
+			}
+		}
+
+		void apply(std::string& str) const
+		{
+			if (_rules.empty()) { return; }
+
+			std::vector<int> rule_at(str.size(), -1); // The longest match starting at each position.
+			int node = 0;
+			for (size_t i = 0; i < str.size(); ++i) {
+				while (node > 0 && child(node, str[i]) < 0) { node = _nodes[node].fail; }
+				node = std::max(child(node, str[i]), 0);
+				for (int match = _nodes[node].rule >= 0 ? node : _nodes[node].output; match > 0; match = _nodes[match].output) {
+					const int rule = _nodes[match].rule;
+					const size_t start = i + 1 - _rules[rule].first.size();
+					if (rule_at[start] < 0 || _rules[rule_at[start]].first.size() < _rules[rule].first.size()) {
+						rule_at[start] = rule;
+					}
+				}
+			}
+
+			std::string result;
+			result.reserve(str.size());
+			for (size_t i = 0; i < str.size();) {
+				if (rule_at[i] >= 0) {
+					result += _rules[rule_at[i]].second;
+					i += _rules[rule_at[i]].first.size();
+				}
+				else {
+					result += str[i++];
+				}
+			}
+			str.swap(result);
+		}
+
+	private:
+		struct Node
+		{
+			std::vector<std::pair<char, int>> next;
+			int fail   = 0;  // The longest proper suffix in the trie.
+			int output = -1; // The longest proper suffix that is a pattern.
+			int rule   = -1; // If this node is the end of a pattern.
+		};
+
+		int child(int node, char c) const
+		{
+			for (const auto& edge : _nodes[node].next) {
+				if (edge.first == c) { return edge.second; }
+			}
+			return -1;
+		}
+
+		std::vector<Node> _nodes;
+		StringPairList    _rules;
+	};
+
+	// The rest of a stack trace line after the address, by address. Protected by s_symbol_mutex.
+	static std::unordered_map<const void*, std::string> s_symbol_cache;
+	static StackCleaner s_stack_cleaner; // Protected by s_symbol_mutex.
+	const size_t MAX_CACHED_SYMBOLS = 4096;
+
+	// Must be called with s_symbol_mutex locked.
+	static void update_stack_cleaner()
+	{
+		if (!s_stack_cleanups_changed) { return; }
+		s_stack_cleaner = StackCleaner();
+		for (const auto& p : s_user_stack_cleanups) {
+			s_stack_cleaner.add(p.first, p.second);
+		}
+		for (const auto& p : REPLACE_LIST) {
+			if (p.first.size() > p.second.size()) { // On gcc, "type_name<std::string>()" is "std::string"
+				s_stack_cleaner.add(p.first, p.second);
+			}
+		}
+		s_stack_cleaner.link();
+		s_symbol_cache.clear();
+		s_stack_cleanups_changed = false;
+	}
+
+	struct StackRegexes
+	{
+		StackRegexes()
+		{
+			try {
+				std_allocator = std::regex(R"(,\s*std::allocator<[^<>]+>)");
+				template_spaces = std::regex(R"(<\s*([^<> ]+)\s*>)");
+				ok = true;
+			}
+			catch (std::regex_error&) {
+				// Probably old GCC.
+			}
+		}
+
+		std::regex std_allocator;
+		std::regex template_spaces;
+		bool       ok = false;
+	};
+
+	static std::string prettify_symbol(std::string symbol)
+	{
+		s_stack_cleaner.apply(symbol);
+		static const StackRegexes regexes;
+		if (regexes.ok) {
+			symbol = std::regex_replace(symbol, regexes.std_allocator, std::string(""));
+			symbol = std::regex_replace(symbol, regexes.template_spaces, std::string("<$1>"));
+		}
+		return symbol;
+	}
+
+	// With s_symbol_mutex locked if pretty (for the stack cleanups).
+	static std::string symbolize(void* address, bool pretty)
+	{
+		std::string symbol;
+		Dl_info info;
+#if LOGURU_STACKTRACE_SYMBOLIZE
+		if (dladdr(address, &info) && info.dli_sname) {
+			char* demangled = NULL;
+			int status = -1;
+			if (info.dli_sname[0] == '_') {
+				demangled = abi::__cxa_demangle(info.dli_sname, 0, 0, &status);
+			}
+			char offset[32];
+			snprintf(offset, sizeof(offset), " + %td", static_cast<char*>(address) - static_cast<char*>(info.dli_saddr));
+			symbol = std::string(status == 0 ? demangled : info.dli_sname) + offset;
+			if (pretty) { symbol = prettify_symbol(std::move(symbol)); }
+			free(demangled);
+		}
+		else if (char** symbols = backtrace_symbols(&address, 1)) {
+			symbol = symbols[0];
+			free(symbols);
+		}
+#else
+		if (dladdr(address, &info) && info.dli_fname) {
+			char offset[32];
+			snprintf(offset, sizeof(offset), "(+%#tx)", static_cast<char*>(address) - static_cast<char*>(info.dli_fbase));
+			symbol = std::string(info.dli_fname) + offset;
+		}
+		(void)pretty;
+#endif
+		return symbol;
+	}
+
+	// Must be called with s_symbol_mutex locked.
+	static const std::string& frame_symbol(void* address)
+	{
+		auto it = s_symbol_cache.find(address);
+		if (it != s_symbol_cache.end()) { return it->second; }
+		if (s_symbol_cache.size() >= MAX_CACHED_SYMBOLS) { s_symbol_cache.clear(); }
+		return s_symbol_cache.emplace(address, symbolize(address, true)).first->second;
+	}
+
+	static std::string format_stacktrace(int skip, bool fatal)
+	{
+		// From https://gist.github.com/fmela/591333
+		void* callstack[128];
+		const auto max_frames = sizeof(callstack) / sizeof(callstack[0]);
+		int num_frames = backtrace(callstack, max_frames);
+
+		std::string result;
+		if (num_frames == max_frames) {
+			result = "[truncated]\n";
+		}
+
+		// A FATAL message may come from the thread that holds the lock (e.g. a crash while symbolizing,
+		// then the signal handler), so it does not wait for it: without it, each frame is looked up afresh.
+		std::unique_lock<std::mutex> lock(s_symbol_mutex, std::defer_lock);
+		if (fatal) { lock.try_lock(); } else { lock.lock(); }
+		if (lock.owns_lock()) { update_stack_cleaner(); }
+		// Print stack traces so the most relevant ones are written last
+		// Rationale: http://yellerapp.com/posts/2015-01-22-upside-down-stacktraces.html
+		for (int i = num_frames - 1; i >= skip; --i) {
+			char buf[64];
+			snprintf(buf, sizeof(buf), "%-3d %*p ", i - skip, int(2 + sizeof(void*) * 2), callstack[i]);
+			result += buf;
+			result += lock.owns_lock() ? frame_symbol(callstack[i]) : symbolize(callstack[i], false);
+			result += '\n';
+		}
+
+		if (!result.empty() && result[result.size() - 1] == '\n') {
+			result.resize(result.size() - 1);
+		}
+
+		return result;
+	}
+
+	std::string stacktrace_as_stdstring(int skip)
+	{
+		return format_stacktrace(skip + 1, false);
+	}
+
+#else // LOGURU_STACKTRACES
+	Text demangle(const char* name)
+	{
+		return Text(_strdup(name));
+	}
+
+	std::string stacktrace_as_stdstring(int)
+	{
+		//#warning "Loguru: No stacktraces available on this platform"
+		//include stackwalker here
+		//StackWalkerToConsole sw;
+		//sw.ShowCallstack();
+		return "";
+	}
+
+	static std::string format_stacktrace(int, bool)
+	{
+		return "";
+	}
+
+#endif // LOGURU_STACKTRACES
+
+	Text stacktrace(int skip)
+	{
+		auto str = stacktrace_as_stdstring(skip + 1);
+		return Text(_strdup(str.c_str()));
+	}
+
+	// ------------------------------------------------------------------------
+
+	// Appends to a fixed size buffer, truncating and null-terminating like snprintf.
+	class PreambleWriter
+	{
+	public:
+		PreambleWriter(char* buff, size_t buff_size) : _out(buff), _end(buff + buff_size - 1) {}
+		~PreambleWriter() { *_out = '\0'; }
+
+		void write(char c)
+		{
+			if (_out < _end) { *_out++ = c; }
+		}
+
+		void write(const char* str, size_t length)
+		{
+			length = std::min<size_t>(length, _end - _out);
+			memcpy(_out, str, length);
+			_out += length;
+		}
+
+		void write(const char* str) { write(str, strlen(str)); }
+
+		void pad(size_t length, size_t width)
+		{
+			for (; length < width; ++length) { write(' '); }
+		}
+
+		// Like %*s
+		void write_right(const char* str, size_t width)
+		{
+			const size_t length = strlen(str);
+			pad(length, width);
+			write(str, length);
+		}
+
+		// Like %0*u or %*u, depending on 'fill'.
+		void write_uint(unsigned long long value, size_t width, char fill)
+		{
+			char digits[20];
+			size_t num_digits = 0;
+			do {
+				digits[num_digits++] = char('0' + value % 10);
+				value /= 10;
+			} while (value != 0);
+			for (size_t i = num_digits; i < width; ++i) { write(fill); }
+			while (num_digits != 0) { write(digits[--num_digits]); }
+		}
+
+		// Like %-*u
+		void write_uint_left(unsigned long long value, size_t width)
+		{
+			char* start = _out;
+			write_uint(value, 0, ' ');
+			pad(static_cast<size_t>(_out - start), width);
+		}
+
+		// Like %8.3f of uptime_ms / 1000.0
+		void write_uptime(long long uptime_ms)
+		{
+			const auto ms = static_cast<unsigned long long>(std::max(uptime_ms, 0LL));
+			write_uint(ms / 1000, 4, ' ');
+			write('.');
+			write_uint(ms % 1000, 3, '0');
+		}
+
+	private:
+		char* _out;
+		char* _end;
+	};
+
+	// "YYYY-MM-DD HH:MM:SS" for the given second, recomputed at most once a second per thread.
+	static const char* cached_date_time(long long sec_since_epoch)
+	{
+		if (sec_since_epoch != s_date_time_sec) {
+			time_t sec = time_t(sec_since_epoch);
+			tm time_info;
+#if defined(_MSC_VER)
+			localtime_s(&time_info, &sec);
+#elif defined(__BORLANDC__)
+			localtime_s(&sec, &time_info);
+#else
+			localtime_r(&sec, &time_info);
+#endif
+			snprintf(s_date_time, sizeof(s_date_time), "%04d-%02d-%02d %02d:%02d:%02d",
+				1900 + time_info.tm_year, 1 + time_info.tm_mon, time_info.tm_mday,
+				time_info.tm_hour, time_info.tm_min, time_info.tm_sec);
+			s_date_time_sec = sec_since_epoch;
+		}
+		return s_date_time;
+	}
+
+	// The thread name, as shown in the preamble. Cached until set_thread_name is called.
+	static const char* cached_thread_name()
+	{
+		if (!s_thread_name_cached) {
+			get_thread_name(s_thread_name, sizeof(s_thread_name), true);
+			s_thread_name_cached = true;
+		}
+		return s_thread_name;
+	}
+
+	static const char* level_text(Verbosity verbosity)
+	{
+		if (verbosity <= Verbosity_FATAL)   { return " F\t"; }
+		if (verbosity == Verbosity_ERROR)   { return " E\t"; }
+		if (verbosity == Verbosity_WARNING) { return " W\t"; }
+		if (verbosity == Verbosity_INFO)    { return " I\t"; }
+		return "";
+	}
+
+	// Must be called on the logging thread.
+	static void make_preamble_info(PreambleInfo& info, Verbosity verbosity, const char* file, unsigned line)
+	{
+		info.parts = Preamble_All;
+		info.verbosity = verbosity;
+		info.file = s_strip_file_path ? filename(file) : file;
+		info.line = line;
+		info.ms_since_epoch = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+		const auto now = steady_clock::now();
+		info.uptime_ms = duration_cast<milliseconds>(now - s_start_time).count();
+		info.time_ns = duration_cast<nanoseconds>(now.time_since_epoch()).count();
+
+		const unsigned thread_index = get_thread_index(); // Assign it in the order threads first log.
+		PreambleWriter thread(info.thread, sizeof(info.thread));
+		if (g_preamble_thread_index) {
+			thread.write_uint(thread_index, THREAD_NAME_WIDTH, ' ');
+		}
+		else {
+			thread.write(cached_thread_name());
+		}
+	}
+
+	static void print_preamble(char* out_buff, size_t out_buff_size, const PreambleInfo& info, unsigned fields)
+	{
+		const long long ms_since_epoch = info.ms_since_epoch;
+		const long long uptime_ms = info.uptime_ms;
+		const Verbosity verbosity = info.verbosity;
+		const char* file = info.file;
+		const unsigned line = info.line;
+
+		PreambleWriter out(out_buff, out_buff_size);
+
+#ifdef _MSC_VER
+		if (time_off) {
+			// "(%8.3fs) [%s]%20s:%-5u " or "(%8.3fs) [%s] "
+			out.write('(');
+			out.write_uptime(uptime_ms);
+			out.write("s) [");
+			out.write(level_text(verbosity));
+			out.write(']');
+			if (is_filter_on(Filter_NameOn)) {
+				out.write_right(file, 20);
+				out.write(':');
+				out.write_uint_left(line, 5);
+			}
+			out.write(' ');
+			return;
+		}
+#endif
+
+		// "%s.%03lld (%8.3fs) [%-*s]%23s:%-5u %4s| ", without the parts not in fields.
+		if (fields & Preamble_DateTime) {
+			out.write(cached_date_time(ms_since_epoch / 1000), 19);
+			out.write('.');
+			out.write_uint(static_cast<unsigned long long>(ms_since_epoch % 1000), 3, '0');
+			out.write(' ');
+		}
+		if (fields & Preamble_Uptime) {
+			out.write('(');
+			out.write_uptime(uptime_ms);
+			out.write("s) ");
+		}
+		if (fields & Preamble_Thread) {
+			const size_t thread_length = strlen(info.thread);
+			out.write('[');
+			out.write(info.thread, thread_length);
+			out.pad(thread_length, THREAD_NAME_WIDTH);
+			out.write(']');
+		}
+		if (fields & Preamble_File) {
+			out.write_right(file, 23);
+			out.write(':');
+			out.write_uint_left(line, 5);
+			out.write(' ');
+		}
+		if (fields & Preamble_Verbosity) {
+			out.write_right(level_text(verbosity), 4);
+		}
+		out.write("| ");
+	}
+
+	const char* Preambles::get(unsigned fields)
+	{
+		fields &= _info.parts;
+		if (fields == Preamble_None) { return ""; }
+		for (int i = 0; i < _num_built; ++i) {
+			if (_fields[i] == fields) { return _buffs[i]; }
+		}
+		const int i = _num_built < MAX_BUILT ? _num_built++ : MAX_BUILT - 1;
+		print_preamble(_buffs[i], sizeof(_buffs[i]), _info, fields);
+		_fields[i] = fields;
+		return _buffs[i];
+	}
+
+	// ------------------------------------------------------------------------
+	// Flushing: an output with a flush interval is flushed by the flusher thread, which sleeps
+	// until the first unflushed line of some output is due. Idle outputs never wake it up.
+
+	static int flush_interval_ms(const SinkFlush& state)
+	{
+		const int interval_ms = state.interval_ms.load(std::memory_order_relaxed);
+		return interval_ms < 0 ? static_cast<int>(g_flush_interval_ms) : interval_ms;
+	}
+
+	static void call_flush(const Callback& callback)
+	{
+		const long long start_ns = g_time_outputs ? now_ns() : 0;
+		callback.flush(callback.user_data);
+		if (start_ns != 0) { stats_add(callback.stats->total_ns, now_ns() - start_ns); }
+		callback.stats->flushes.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	static void log_stats();
+
+	// Flushes the outputs that are due. Returns when the next one is, or 0 if none is dirty.
+	static long long flush_due_outputs()
+	{
+		std::lock_guard<std::recursive_mutex> lock(s_mutex);
+		const long long now = now_ns();
+		long long next_ns = 0;
+		auto is_due = [&](SinkFlush& state) {
+			const long long dirty_since = state.dirty_since_ns.load();
+			if (dirty_since == 0) { return false; }
+			const long long due_ns = dirty_since + flush_interval_ms(state) * 1000000LL;
+			if (due_ns > now) {
+				next_ns = next_ns == 0 ? due_ns : std::min(next_ns, due_ns);
+				return false;
+			}
+			state.dirty_since_ns.store(0); // Before flushing, so the lines after it mark it again.
+			return true;
+		};
+
+		if (is_due(s_stderr_flush)) {
+			fflush(stderr);
+			s_stats.stderr_stats.flushes.fetch_add(1, std::memory_order_relaxed);
+		}
+		if (const CallbackList* list = s_callbacks.load()) {
+			for (const auto& callback : list->callbacks) {
+				if (is_due(*callback.flush_state)) {
+					call_flush(callback);
+				}
+			}
+		}
+		if (is_due(s_stats_flush)) {
+			log_stats();
+		}
+		return next_ns;
+	}
+
+	// path.1 -> path.2 etc, dropping the oldest, then the current file becomes path.1 and we start on a new one.
+	// On the flusher thread: the renames and the opening of the new file are done without s_mutex,
+	// so only the final swap holds up the logging threads.
+	static void file_sink_rotate(FileSink& sink)
+	{
+		const std::string& path = sink.path;
+		auto rotated_path = [&](unsigned index) { return path + "." + std::to_string(index); };
+
+		if (sink.rotation.max_files > 0) {
+			remove(rotated_path(sink.rotation.max_files).c_str());
+			for (unsigned index = sink.rotation.max_files; index > 1; --index) {
+				rename(rotated_path(index - 1).c_str(), rotated_path(index).c_str());
+			}
+		}
+
+#ifdef _WIN32
+		// Windows can't rename an open file, so this all happens under the lock.
+		std::lock_guard<std::recursive_mutex> lock(s_mutex);
+		file_sink_write(sink, nullptr, 0);
+		fclose(sink.file);
+		if (sink.rotation.max_files == 0) {
+			remove(path.c_str());
+		} else {
+			rename(path.c_str(), rotated_path(1).c_str());
+		}
+		FILE* new_file = open_log_file(path.c_str(), "w");
+		if (!new_file) {
+			fprintf(stderr, "Loguru: failed to open '%s' after rotating it\n", path.c_str());
+			new_file = open_log_file(rotated_path(1).c_str(), "a");
+			if (!new_file) { new_file = open_log_file("NUL", "w"); }
+		}
+		FILE* old_file = nullptr;
+#else
+		// Opened ahead of time under another name, then renamed over the full file (which stays open until then).
+		const std::string next_path = path + ".next";
+		FILE* new_file = open_log_file(next_path.c_str(), "w");
+		std::lock_guard<std::recursive_mutex> lock(s_mutex);
+		if (!new_file) {
+			fprintf(stderr, "Loguru: failed to open '%s' to rotate '%s'\n", next_path.c_str(), path.c_str());
+			sink.rotation_requested = false; // Carry on in the full file.
+			return;
+		}
+		file_sink_write(sink, nullptr, 0);
+		if (sink.rotation.max_files > 0) {
+			rename(path.c_str(), rotated_path(1).c_str());
+		}
+		rename(next_path.c_str(), path.c_str());
+		FILE* old_file = sink.file;
+#endif
+
+		sink.file = new_file;
+		sink.fd = file_descriptor(new_file);
+		sink.file_size = 0;
+		sink.rotation_requested = false;
+		file_sink_write_header(sink);
+		if (old_file) { fclose(old_file); }
+	}
+
+	// Rotates the files that are due. Returns when the next rollover is, or 0 if none is.
+	static long long rotate_due_files()
+	{
+		CallbackReader reader; // remove_callback waits for us before closing the file.
+		const CallbackList* list = reader.list();
+		if (!list) { return 0; }
+		long long next_ns = 0;
+		for (const auto& callback : list->callbacks) {
+			if (callback.callback != file_log) { continue; }
+			FileSink& sink = *static_cast<FileSink*>(callback.user_data);
+			bool due = false;
+			if (sink.next_rollover != 0) {
+				const time_t now = time(nullptr);
+				if (now >= sink.next_rollover) {
+					due = true;
+					sink.next_rollover = next_rollover_time(sink.rotation.interval);
+				}
+				const long long due_ns = now_ns() + (static_cast<long long>(sink.next_rollover) - now) * 1000000000LL;
+				next_ns = next_ns == 0 ? due_ns : std::min(next_ns, due_ns);
+			}
+			if (!due) {
+				std::lock_guard<std::recursive_mutex> lock(s_mutex);
+				due = sink.rotation_requested;
+			}
+			if (due) {
+				file_sink_rotate(sink);
+			}
+		}
+		return next_ns;
+	}
+
+	static void flusher_loop()
+	{
+		std::unique_lock<std::mutex> lock(s_flusher_mutex);
+		const auto woken = [] { return s_flusher_stop || s_flusher_wake; };
+		while (!s_flusher_stop) {
+			s_flusher_wake = false;
+			lock.unlock();
+			const long long rotate_ns = rotate_due_files();
+			const long long flush_ns = flush_due_outputs();
+			const long long next_ns = rotate_ns == 0 || flush_ns == 0 ? rotate_ns + flush_ns : std::min(rotate_ns, flush_ns);
+			lock.lock();
+			if (next_ns == 0) {
+				s_flusher_cv.wait(lock, woken);
+			} else {
+				s_flusher_cv.wait_for(lock, nanoseconds(next_ns - now_ns()), woken);
+			}
+		}
+	}
+
+	// Called after writing a line to an output. Returns true if it should be flushed right away,
+	// else makes sure the flusher will get to it (waking it if this is the first unflushed line).
+	static bool mark_dirty(SinkFlush& state)
+	{
+		if (flush_interval_ms(state) == 0) { return !state.batches; }
+		long long clean = 0;
+		if (state.dirty_since_ns.load(std::memory_order_relaxed) == 0
+			&& state.dirty_since_ns.compare_exchange_strong(clean, now_ns())) {
+			wake_flusher();
+		}
+		return false;
+	}
+
+	// Makes the flusher flush the output as soon as it can, e.g. to send an ERROR without waiting for the interval.
+	static void flush_soon(SinkFlush& state)
+	{
+		state.dirty_since_ns.store(1);
+		wake_flusher();
+	}
+
+	// Starts the flusher thread if needed.
+	static void wake_flusher()
+	{
+		std::lock_guard<std::mutex> lock(s_flusher_mutex);
+		if (!s_flusher_thread) {
+			s_flusher_thread = new std::thread(flusher_loop);
+			if (!s_flusher_at_exit) {
+				// Joined before the destruction of our statics: s_flusher_cv can't be destroyed while waited on.
+				atexit(stop_flusher);
+				s_flusher_at_exit = true;
+			}
+		}
+		s_flusher_wake = true;
+		s_flusher_cv.notify_one();
+	}
+
+	static void stop_flusher()
+	{
+		std::thread* thread;
+		{
+			std::lock_guard<std::mutex> lock(s_flusher_mutex);
+			thread = s_flusher_thread;
+			s_flusher_stop = true;
+			s_flusher_cv.notify_one();
+		}
+		if (thread) {
+			thread->join();
+			delete thread;
+		}
+		std::lock_guard<std::mutex> lock(s_flusher_mutex);
+		s_flusher_thread = nullptr;
+		s_flusher_stop = false;
+	}
+
+	// text_size is that of the prefix, message and newline. With g_time_outputs, clock_ns is when the previous
+	// output was done (0 if none), so that each output costs one clock read.
+	static void call_callback(const Callback& p, Message& message, Preambles& preambles, bool with_indentation,
+		const ScopeDepths& depths, size_t text_size, long long& clock_ns)
+	{
+		const bool timed = g_time_outputs;
+		if (timed && clock_ns == 0) { clock_ns = now_ns(); }
+		message.preamble = preambles.get(p.preamble_fields);
+		if (with_indentation) {
+			message.indentation = indentation(scope_depth(depths, p.verbosity));
+		}
+		p.callback(p.user_data, message);
+		if (p.flush && mark_dirty(*p.flush_state)) {
+			if (s_thread_is_draining) {
+				p.flush_state->flush_after_batch = true;
+			}
+			else {
+				p.flush(p.user_data);
+				p.stats->flushes.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+		stats_count_call(*p.stats, strlen(message.preamble) + strlen(message.indentation) + text_size, p.thread_safe);
+		if (timed) {
+			const long long done_ns = now_ns();
+			stats_time_call(*p.stats, done_ns - clock_ns);
+			clock_ns = done_ns;
+		}
+	}
+
+	static size_t text_size(const Message& message)
+	{
+		return strlen(message.prefix) + strlen(message.message) + 1;
+	}
+
+	// Writes the message to the thread-safe callbacks, without locking s_mutex.
+	static void write_message_to_thread_safe_callbacks(Message& message, Preambles& preambles, bool with_indentation,
+		const ScopeDepths& depths)
+	{
+		if (!s_has_thread_safe_callbacks.load(std::memory_order_relaxed)) { return; }
+		CallbackReader reader;
+		const CallbackList* list = reader.list();
+		if (!list) { return; }
+		const auto out_verbosity = output_verbosity(message.verbosity, message.filename);
+		const size_t size = text_size(message);
+		long long clock_ns = 0;
+		for (const auto& p : list->callbacks) {
+			if (p.thread_safe && out_verbosity <= p.verbosity) {
+				call_callback(p, message, preambles, with_indentation, depths, size, clock_ns);
+			}
+		}
+	}
+
+	// The escape sequences around a stderr line.
+	struct StderrStyle
+	{
+		std::string start;             // Before the preamble.
+		std::string middle;            // Between the indentation and the prefix.
+		std::string end;               // Before the newline.
+		unsigned short console_attribute; // For SetConsoleTextAttribute (Windows).
+	};
+
+	static const StderrStyle& stderr_style(Verbosity verbosity)
+	{
+		// Built once: the terminal does not change.
+		static const StderrStyle styles[] = {
+			{ "", "", "", 8 }, // Without colors
+			{ std::string(terminal_reset()) + terminal_dim(), std::string(terminal_reset()) + terminal_light_gray(), terminal_reset(), 8 },
+			{ std::string(terminal_reset()) + terminal_dim(), std::string(terminal_reset()) + terminal_bold(), terminal_reset(), 8 },
+			{ std::string(terminal_reset()) + terminal_bold() + terminal_red(), "", terminal_reset(), 14 },
+			{ std::string(terminal_reset()) + terminal_bold() + terminal_light_red(), "", terminal_reset(), 12 },
+		};
+		if (!g_colorlogtostderr || !s_terminal_has_color) { return styles[0]; }
+		if (verbosity > Verbosity_INFO)    { return styles[1]; }
+		if (verbosity == Verbosity_INFO)    { return styles[2]; }
+		if (verbosity == Verbosity_WARNING) { return styles[3]; }
+		return styles[4];
+	}
+
+	// Must be called with s_mutex locked.
+	static void write_stderr_line(const Message& message, long long& clock_ns)
+	{
+		const StderrStyle& style = stderr_style(message.verbosity);
+		const Chunk chunks[] = {
+			{ style.start.data(),  style.start.size()          },
+			{ message.preamble,    strlen(message.preamble)    },
+			{ message.indentation, strlen(message.indentation) },
+			{ style.middle.data(), style.middle.size()         },
+			{ message.prefix,      strlen(message.prefix)      },
+			{ message.message,     strlen(message.message)     },
+			{ style.end.data(),    style.end.size()            },
+			{ "\n",                1                           },
+		};
+#ifdef _WIN32
+#if _MSC_VER
+		set_console_attribute(style.console_attribute);
+#endif
+		for (const auto& chunk : chunks) {
+			fwrite(chunk.data, 1, chunk.size, stderr);
+		}
+		if (mark_dirty(s_stderr_flush)) {
+			fflush(stderr);
+			s_stats.stderr_stats.flushes.fetch_add(1, std::memory_order_relaxed);
+		}
+#else
+		// One writev, without the stdio lock or buffer: stderr is unbuffered, so the line is out right away.
+		iovec iov[8];
+		int num_iov = 0;
+		for (const auto& chunk : chunks) {
+			if (chunk.size > 0) {
+				iov[num_iov++] = iovec{ const_cast<char*>(chunk.data), chunk.size };
+			}
+		}
+		write_iov(STDERR_FILENO, iov, num_iov);
+#endif
+		size_t bytes = 0;
+		for (const auto& chunk : chunks) { bytes += chunk.size; }
+		stats_count_call(s_stats.stderr_stats, bytes, false);
+		if (clock_ns != 0) {
+			const long long done_ns = now_ns();
+			stats_time_call(s_stats.stderr_stats, done_ns - clock_ns);
+			clock_ns = done_ns;
+		}
+	}
+
+	// Writes the message to stderr and the callbacks, optionally skipping the thread-safe ones.
+	// Must be called with s_mutex locked.
+	static void write_message(Message& message, Preambles& preambles, bool with_indentation, const ScopeDepths& depths,
+		bool with_thread_safe)
+	{
+		const auto verbosity = message.verbosity;
+		const auto out_verbosity = output_verbosity(verbosity, message.filename);
+
+		if (with_indentation) {
+			message.indentation = indentation(scope_depth(depths, g_stderr_verbosity));
+		}
+
+		long long clock_ns = 0;
+		if (out_verbosity <= g_stderr_verbosity) {
+			if (g_time_outputs) { clock_ns = now_ns(); }
+			message.preamble = preambles.get(Preamble_All);
+			write_stderr_line(message, clock_ns);
+		}
+
+		if (const CallbackList* list = s_callbacks.load()) {
+			size_t size = 0;
+			for (const auto& p : list->callbacks) {
+				if (out_verbosity <= p.verbosity && (with_thread_safe || !p.thread_safe)) {
+					if (size == 0) { size = text_size(message); }
+					call_callback(p, message, preambles, with_indentation, depths, size, clock_ns);
+				}
+			}
+		}
+	}
+
+	// ------------------------------------------------------------------------
+	// Async logging:
+
+	struct AsyncRecord
+	{
+		PreambleInfo preamble;
+		bool        with_indentation;
+		ScopeDepths scope_depths;       // Of the logging thread, at the time of logging.
+		char*       text;               // prefix + '\0' + message. Points to inline_text, or to a malloc:ed copy.
+		size_t      prefix_length;
+		const Field* fields;            // Copied into text, after the message.
+		size_t      num_fields;
+		alignas(Field) char inline_text[256]; // Most messages fit here, so queueing them does not allocate.
+	};
+
+	// One slot of a bounded MPMC queue (Dmitry Vyukov's design).
+	// 'sequence' tells whether the slot is free (== pos) or holds a message (== pos + 1).
+	struct AsyncCell
+	{
+		std::atomic<size_t> sequence;
+		AsyncRecord         record;
+	};
+
+	static AsyncCell*              s_async_cells = nullptr;
+	static size_t                  s_async_mask = 0;
+	static std::atomic<size_t>     s_async_enqueue_pos{ 0 };
+	static std::atomic<size_t>     s_async_dequeue_pos{ 0 };
+	static std::atomic<bool>       s_async_running{ false };
+	static std::atomic<OverflowPolicy> s_async_overflow{ Overflow_Block };
+	static std::atomic<unsigned long long> s_async_dropped{ 0 };
+	static unsigned long long      s_async_dropped_reported = 0; // Protected by s_mutex.
+	static std::atomic<bool>       s_async_writer_sleeping{ false };
+	static bool                    s_async_stop = false;     // Protected by s_async_mutex.
+	static std::thread*            s_async_thread = nullptr;
+	static std::mutex              s_async_mutex;
+	static std::condition_variable s_async_wake;
+
+	class DrainingScope
+	{
+	public:
+		DrainingScope() { s_thread_is_draining = true; }
+		~DrainingScope()
+		{
+			s_thread_is_draining = false;
+			if (const CallbackList* list = s_callbacks.load()) {
+				for (const auto& callback : list->callbacks) {
+					if (callback.flush_state->flush_after_batch) {
+						callback.flush_state->flush_after_batch = false;
+						call_flush(callback);
+					}
+				}
+			}
+		}
+	};
+
+	// Pushed and not yet popped, including the slots that are still being filled in.
+	static size_t async_backlog()
+	{
+		return s_async_enqueue_pos.load() - s_async_dequeue_pos.load();
+	}
+
+	static size_t async_wake_backlog()
+	{
+		return (s_async_mask + 1) / 8;
+	}
+
+	// Claims the oldest message in the queue. Returns false if it is empty or still being filled in.
+	static bool async_try_pop(size_t& out_pos)
+	{
+		size_t pos = s_async_dequeue_pos.load(std::memory_order_relaxed);
+		for (;;) {
+			const size_t seq = s_async_cells[pos & s_async_mask].sequence.load(std::memory_order_acquire);
+			const auto diff = static_cast<long long>(seq) - static_cast<long long>(pos + 1);
+			if (diff == 0) {
+				if (s_async_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					out_pos = pos;
+					return true;
+				}
+			}
+			else if (diff < 0) {
+				return false;
+			}
+			else {
+				pos = s_async_dequeue_pos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// Hands a claimed slot back to the producers.
+	static void async_release(size_t pos)
+	{
+		AsyncCell& cell = s_async_cells[pos & s_async_mask];
+		if (cell.record.text != cell.record.inline_text) {
+			free(cell.record.text);
+		}
+		cell.sequence.store(pos + s_async_mask + 1, std::memory_order_release);
+	}
+
+	static void async_write(size_t pos)
+	{
+		AsyncRecord& record = s_async_cells[pos & s_async_mask].record;
+		if (record.preamble.time_ns != 0) {
+			const long long queued_ns = now_ns() - record.preamble.time_ns;
+			stats_add(s_stats.async_queue_ns, queued_ns);
+			stats_max(s_stats.async_queue_max_ns, queued_ns);
+		}
+		Preambles preambles(record.preamble);
+		auto message = Message{ record.preamble.verbosity, record.preamble.file, record.preamble.line, "", "",
+			record.text, record.text + record.prefix_length + 1, record.fields, record.num_fields,
+			record.preamble.ms_since_epoch };
+		write_message(message, preambles, record.with_indentation, record.scope_depths, true);
+		async_release(pos);
+	}
+
+	// Tells the readers of the log that there is a gap in it.
+	static void async_report_dropped()
+	{
+		const auto num_dropped = s_async_dropped.load(std::memory_order_relaxed);
+		if (num_dropped == s_async_dropped_reported) { return; }
+		char text[128];
+		snprintf(text, sizeof(text), "Loguru async queue overflow: %llu messages dropped",
+			num_dropped - s_async_dropped_reported);
+		s_async_dropped_reported = num_dropped;
+
+		PreambleInfo info;
+		make_preamble_info(info, Verbosity_WARNING, __FILE__, __LINE__);
+		Preambles preambles(info);
+		auto message = Message{ Verbosity_WARNING, __FILE__, __LINE__, "", "", "", text, nullptr, 0, info.ms_since_epoch };
+		write_message(message, preambles, false, ScopeDepths(), true);
+	}
+
+	// Writes all messages that are ready, stopping at the first slot still being filled in.
+	// Must be called with s_mutex locked, so that there is only one writer at a time.
+	static void async_drain_published()
+	{
+		WritingScope writing;
+		DrainingScope draining;
+		size_t pos;
+		while (async_try_pop(pos)) {
+			async_write(pos);
+		}
+		async_report_dropped();
+	}
+
+	// Writes everything pushed before the call, waiting for slots that are still being filled in.
+	// Must be called with s_mutex locked.
+	static void async_drain_all()
+	{
+		if (!s_async_cells || s_thread_is_writing) { return; }
+		WritingScope writing;
+		DrainingScope draining;
+		const size_t end = s_async_enqueue_pos.load();
+		while (s_async_dequeue_pos.load(std::memory_order_relaxed) < end) {
+			size_t pos;
+			if (async_try_pop(pos)) {
+				async_write(pos);
+			}
+			else {
+				std::this_thread::yield(); // Claimed by a producer which has yet to fill it in.
+			}
+		}
+		async_report_dropped();
+	}
+
+#ifndef _WIN32
+	static void write_fd(int fd, const char* data, size_t size)
+	{
+		auto result = write(fd, data, size);
+		(void)result; // Ignore errors.
+	}
+
+	static void write_fd(int fd, const char* data)
+	{
+		write_fd(fd, data, strlen(data));
+	}
+
+	static void write_bounded(int fd, const char* text, size_t max_size)
+	{
+		write_fd(fd, text, strnlen(text, max_size));
+	}
+
+	/* For the crash report: writes the last max_records messages of the queue without locks or heap
+	   allocations. This is best effort, since other threads may still be logging. The messages after
+	   the marker never got to the outputs. */
+	static void write_async_records(int fd, unsigned max_records)
+	{
+		if (!s_async_cells || max_records == 0) { return; }
+		const size_t capacity = s_async_mask + 1;
+		const size_t end = s_async_enqueue_pos.load(std::memory_order_relaxed);
+		const size_t num_records = std::min(std::min<size_t>(capacity, max_records), end);
+		bool wrote_marker = false;
+
+		write_fd(fd, "Last messages in the async queue:\n");
+		for (size_t pos = end - num_records; pos != end; ++pos) {
+			const AsyncCell& cell = s_async_cells[pos & s_async_mask];
+			const size_t seq = cell.sequence.load(std::memory_order_acquire);
+			const bool pending = seq == pos + 1;
+			if (!pending && seq != pos + capacity) { continue; } // Being filled in, or taken by a newer message.
+
+			if (pending && !wrote_marker) {
+				write_fd(fd, "-------- not written to the outputs --------\n");
+				wrote_marker = true;
+			}
+			const AsyncRecord& record = cell.record;
+			if (const unsigned parts = record.preamble.parts & ~Preamble_DateTime) { // localtime is not async-signal-safe.
+				char preamble[128];
+				print_preamble(preamble, sizeof(preamble), record.preamble, parts);
+				write_fd(fd, preamble);
+			}
+			if (record.text == record.inline_text) {
+				const size_t size = sizeof(record.inline_text);
+				write_bounded(fd, record.inline_text, size);
+				if (record.prefix_length + 1 < size) {
+					write_bounded(fd, record.inline_text + record.prefix_length + 1, size - record.prefix_length - 1);
+				}
+			} else if (pending) {
+				write_fd(fd, record.text);
+				write_fd(fd, record.text + record.prefix_length + 1);
+			} else {
+				write_fd(fd, "(long message, already freed)");
+			}
+			write_fd(fd, "\n", 1);
+		}
+	}
+#endif // !_WIN32
+
+	// Called when the queue is full. Returns false if the new message should be dropped.
+	static bool async_make_room(Verbosity verbosity)
+	{
+		const auto policy = s_async_overflow.load(std::memory_order_relaxed);
+		if (policy == Overflow_DropNewest || (policy == Overflow_DropVerbose && verbosity > Verbosity_INFO)) {
+			s_async_dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		if (policy == Overflow_DropOldest) {
+			size_t pos;
+			if (async_try_pop(pos)) {
+				async_release(pos);
+				s_async_dropped.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+		else {
+			// Block: help the writer thread out.
+			const long long start_ns = now_ns();
+			{
+				std::lock_guard<std::recursive_mutex> lock(s_mutex);
+				async_drain_published();
+			}
+			std::this_thread::yield();
+			stats_add(s_stats.async_full_ns, now_ns() - start_ns);
+			return true;
+		}
+		std::this_thread::yield();
+		return true;
+	}
+
+	// Returns false if the message should be written directly.
+	static bool async_push(const Message& message, const PreambleInfo& preamble, bool with_indentation)
+	{
+		if (!s_async_running.load(std::memory_order_acquire) || s_thread_is_writing) {
+			return false;
+		}
+
+		size_t pos = s_async_enqueue_pos.load(std::memory_order_relaxed);
+		AsyncCell* cell;
+		for (;;) {
+			cell = &s_async_cells[pos & s_async_mask];
+			const size_t seq = cell->sequence.load(std::memory_order_acquire);
+			const auto diff = static_cast<long long>(seq) - static_cast<long long>(pos);
+			if (diff == 0) {
+				if (s_async_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+			else if (diff < 0) {
+				if (!async_make_room(message.verbosity)) {
+					return true;
+				}
+				pos = s_async_enqueue_pos.load(std::memory_order_relaxed);
+			}
+			else {
+				pos = s_async_enqueue_pos.load(std::memory_order_relaxed);
+			}
+		}
+
+		AsyncRecord& record = cell->record;
+		record.preamble           = preamble;
+		record.with_indentation   = with_indentation;
+		if (with_indentation) {
+			record.scope_depths   = s_scope_depths;
+		}
+
+		const size_t prefix_length = strlen(message.prefix);
+		const size_t message_length = strlen(message.message);
+		const size_t text_size = prefix_length + message_length + 2;
+
+		// LOG_KV fields go after the text, followed by copies of their strings.
+		const size_t fields_offset = (text_size + alignof(Field) - 1) / alignof(Field) * alignof(Field);
+		size_t total_size = text_size;
+		if (message.num_fields > 0) {
+			total_size = fields_offset + message.num_fields * sizeof(Field);
+			for (size_t i = 0; i < message.num_fields; ++i) {
+				total_size += strlen(message.fields[i].key) + 1;
+				if (message.fields[i].type == Field_String) {
+					total_size += strlen(message.fields[i].value.s) + 1;
+				}
+			}
+		}
+
+		record.text = total_size <= sizeof(record.inline_text)
+			? record.inline_text : static_cast<char*>(malloc(total_size));
+		memcpy(record.text, message.prefix, prefix_length + 1);
+		memcpy(record.text + prefix_length + 1, message.message, message_length + 1);
+		record.prefix_length = prefix_length;
+
+		record.fields = nullptr;
+		record.num_fields = message.num_fields;
+		if (message.num_fields > 0) {
+			Field* fields = reinterpret_cast<Field*>(record.text + fields_offset);
+			char* strings = reinterpret_cast<char*>(fields + message.num_fields);
+			auto copy_string = [&](const char* str) {
+				const size_t size = strlen(str) + 1;
+				memcpy(strings, str, size);
+				strings += size;
+				return strings - size;
+			};
+			for (size_t i = 0; i < message.num_fields; ++i) {
+				fields[i] = message.fields[i];
+				fields[i].key = copy_string(message.fields[i].key);
+				if (fields[i].type == Field_String) {
+					fields[i].value.s = copy_string(message.fields[i].value.s);
+				}
+			}
+			record.fields = fields;
+		}
+
+		cell->sequence.store(pos + 1); // Publish. seq_cst, so the loads below can't move above it.
+
+		// A futex wake per message costs more than writing it, so only wake the writer for a batch.
+		if (s_async_writer_sleeping.load()
+			&& (message.verbosity <= Verbosity_WARNING || async_backlog() >= async_wake_backlog())
+			&& s_async_writer_sleeping.exchange(false)) {
+			std::lock_guard<std::mutex> lock(s_async_mutex);
+			s_async_wake.notify_one();
+		}
+
+		if (!s_async_running.load()) {
+			// stop_async() raced us and may already have done its final drain.
+			std::lock_guard<std::recursive_mutex> lock(s_mutex);
+			async_drain_all();
+		}
+
+		return true;
+	}
+
+	static void async_writer_loop()
+	{
+		set_thread_name("loguru writer");
+		for (;;) {
+			{
+				std::lock_guard<std::recursive_mutex> lock(s_mutex);
+				async_drain_published();
+			}
+
+			std::unique_lock<std::mutex> lock(s_async_mutex);
+			if (s_async_stop) { break; }
+			s_async_writer_sleeping.store(true);
+			if (async_backlog() < async_wake_backlog() && !s_async_stop) {
+				s_async_wake.wait_for(lock, std::chrono::milliseconds(LOGURU_ASYNC_WAKE_MS));
+			}
+			s_async_writer_sleeping.store(false);
+		}
+	}
+
+	void start_async(unsigned queue_size, OverflowPolicy overflow)
+	{
+		std::lock_guard<std::recursive_mutex> lock(s_mutex);
+		if (s_async_thread) { return; }
+		s_async_overflow.store(overflow, std::memory_order_relaxed);
+
+		if (!s_async_cells) {
+			size_t capacity = 2;
+			while (capacity < queue_size) { capacity *= 2; }
+			s_async_cells = new AsyncCell[capacity];
+			for (size_t i = 0; i < capacity; ++i) {
+				s_async_cells[i].sequence.store(i, std::memory_order_relaxed);
+			}
+			s_async_mask = capacity - 1;
+			atexit(stop_async); // Runs before the destruction of our statics.
+		}
+
+		{
+			std::lock_guard<std::mutex> async_lock(s_async_mutex);
+			s_async_stop = false;
+		}
+		s_async_thread = new std::thread(async_writer_loop);
+		s_async_running.store(true);
+	}
+
+	void stop_async()
+	{
+		if (!outside_callbacks("stop_async")) { return; }
+		std::thread* writer_thread = nullptr;
+		{
+			std::lock_guard<std::recursive_mutex> lock(s_mutex);
+			std::swap(writer_thread, s_async_thread);
+			if (!writer_thread) { return; }
+			s_async_running.store(false);
+		}
+		{
+			std::lock_guard<std::mutex> lock(s_async_mutex);
+			s_async_stop = true;
+		}
+		s_async_wake.notify_one();
+		writer_thread->join();
+		delete writer_thread;
+
+		std::lock_guard<std::recursive_mutex> lock(s_mutex);
+		async_drain_all();
+	}
+
+	unsigned long long async_dropped_count()
+	{
+		return s_async_dropped.load(std::memory_order_relaxed);
+	}
+
+	// ------------------------------------------------------------------------
+	// Stats (get_stats):
+
+	Stats get_stats()
+	{
+		Stats stats = Stats();
+		for (const auto& shard : s_stats.shards) {
+			for (size_t i = 0; i < sizeof(stats.messages) / sizeof(stats.messages[0]); ++i) {
+				stats.messages[i] += shard.messages[i].load(std::memory_order_relaxed);
+			}
+			stats.format_ns    += shard.format_ns.load(std::memory_order_relaxed);
+			stats.lock_wait_ns += shard.lock_wait_ns.load(std::memory_order_relaxed);
+		}
+		stats.async_queue_ns     = s_stats.async_queue_ns.load(std::memory_order_relaxed);
+		stats.async_queue_max_ns = s_stats.async_queue_max_ns.load(std::memory_order_relaxed);
+		stats.async_full_ns      = s_stats.async_full_ns.load(std::memory_order_relaxed);
+		stats.async_dropped      = async_dropped_count();
+		stats.sink_dropped       = s_stats.sink_dropped.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	static OutputStats load_output_stats(const SinkStats& stats)
+	{
+		return OutputStats{ stats.messages.load(std::memory_order_relaxed), stats.bytes.load(std::memory_order_relaxed),
+			stats.flushes.load(std::memory_order_relaxed), stats.total_ns.load(std::memory_order_relaxed),
+			stats.max_ns.load(std::memory_order_relaxed) };
+	}
+
+	bool get_output_stats(const char* id, OutputStats& stats)
+	{
+		if (strcmp(id, "stderr") == 0) {
+			stats = load_output_stats(s_stats.stderr_stats);
+			return true;
+		}
+		std::lock_guard<std::recursive_mutex> lock(s_mutex);
+		if (const CallbackList* list = s_callbacks.load()) {
+			for (const auto& callback : list->callbacks) {
+				if (callback.id == id) {
+					stats = load_output_stats(*callback.stats);
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	static void reset_output_stats(SinkStats& stats)
+	{
+		stats.messages.store(0, std::memory_order_relaxed);
+		stats.bytes.store(0, std::memory_order_relaxed);
+		stats.flushes.store(0, std::memory_order_relaxed);
+		stats.total_ns.store(0, std::memory_order_relaxed);
+		stats.max_ns.store(0, std::memory_order_relaxed);
+	}
+
+	void reset_stats()
+	{
+		for (auto& shard : s_stats.shards) {
+			for (auto& count : shard.messages) {
+				count.store(0, std::memory_order_relaxed);
+			}
+			shard.format_ns.store(0, std::memory_order_relaxed);
+			shard.lock_wait_ns.store(0, std::memory_order_relaxed);
+		}
+		for (auto counter : { &s_stats.async_queue_ns, &s_stats.async_queue_max_ns, &s_stats.async_full_ns }) {
+			counter->store(0, std::memory_order_relaxed);
+		}
+		s_stats.sink_dropped.store(0, std::memory_order_relaxed);
+		reset_output_stats(s_stats.stderr_stats);
+		std::lock_guard<std::recursive_mutex> lock(s_mutex);
+		if (const CallbackList* list = s_callbacks.load()) {
+			for (const auto& callback : list->callbacks) {
+				reset_output_stats(*callback.stats);
+			}
+		}
+	}
+
+	void set_stats_interval(unsigned interval_ms)
+	{
+		s_stats_flush.interval_ms.store(static_cast<int>(interval_ms));
+		if (interval_ms == 0) {
+			s_stats_flush.dirty_since_ns.store(0);
+		}
+	}
+
+	// Called by the flusher, with s_mutex locked.
+	static void log_stats()
+	{
+		std::string text;
+		const Stats stats = get_stats();
+		char buff[256];
+		unsigned long long verbose = 0;
+		for (int v = 1; v <= Verbosity_MAX; ++v) {
+			verbose += stats.messages[v - Verbosity_FATAL];
+		}
+		snprintf(buff, sizeof(buff),
+			"Loguru stats: messages F %llu, E %llu, W %llu, I %llu, 1-9 %llu; format %.3f ms; lock wait %.3f ms; "
+			"async queue %.3f ms, max %.3f ms, full %.3f ms; dropped %llu + %llu",
+			stats.messages[0], stats.messages[1], stats.messages[2], stats.messages[3], verbose,
+			stats.format_ns / 1e6, stats.lock_wait_ns / 1e6,
+			stats.async_queue_ns / 1e6, stats.async_queue_max_ns / 1e6, stats.async_full_ns / 1e6,
+			stats.async_dropped, stats.sink_dropped);
+		text = buff;
+
+		const auto append_output = [&](const char* id, const SinkStats& sink_stats) {
+			const OutputStats output = load_output_stats(sink_stats);
+			snprintf(buff, sizeof(buff), "; %s: %llu lines, %llu bytes, %llu flushes, %.3f ms, max %.3f ms",
+				id, output.messages, output.bytes, output.flushes, output.total_ns / 1e6, output.max_ns / 1e6);
+			text += buff;
+		};
+		append_output("stderr", s_stats.stderr_stats);
+		if (const CallbackList* list = s_callbacks.load()) {
+			for (const auto& callback : list->callbacks) {
+				append_output(callback.id.c_str(), *callback.stats);
+			}
+		}
+
+		s_thread_is_logging_stats = true; // So this line does not count as something new to report.
+		LOG_F(INFO, "%s", text.c_str());
+		s_thread_is_logging_stats = false;
+	}
+
+	// ------------------------------------------------------------------------
+	// Flight recorder (add_flight_recorder):
+	// Each thread appends its lines to its own ring buffer, without locks. The list of buffers only changes
+	// under s_flight_mutex, when a thread logs to the recorder for the first time or exits, so a dump can
+	// take that lock and copy out each buffer while its thread goes on logging.
+
+	struct FlightBuffer
+	{
+		char*                      data = nullptr;
+		size_t                     size = 0;        // A power of two.
+		unsigned                   generation = 0;  // Of the recorder it was made for.
+		bool                       owned = false;   // By a running thread. Protected by s_flight_mutex.
+		char                       thread_name[16];
+		std::atomic<size_t>        reserved{0};     // Bytes written or being written. The buffer holds the last 'size'.
+		std::atomic<size_t>        end{0};          // Bytes written.
+		std::atomic<FlightBuffer*> next{nullptr};
+	};
+
+	static std::mutex                 s_flight_mutex;
+	static std::atomic<FlightBuffer*> s_flight_buffers{nullptr};       // Changed under s_flight_mutex.
+	static std::atomic<int>           s_flight_verbosity{Verbosity_OFF};
+	static std::atomic<unsigned>      s_flight_generation{0};          // Changed under s_flight_mutex.
+	static size_t                     s_flight_buffer_size = 0;        // Protected by s_flight_mutex.
+	static char                       s_flight_path[PATH_MAX] = "";    // For dumps on FATAL and signals.
+	static char*                      s_flight_scratch = nullptr;      // For dumps from the signal handler.
+	static LOGURU_THREAD_LOCAL FlightBuffer* s_flight_buffer = nullptr; // Owned by this thread.
+
+	// Must be called with s_flight_mutex locked.
+	static void flight_free_stale_buffers()
+	{
+		const unsigned generation = s_flight_generation.load();
+		std::atomic<FlightBuffer*>* link = &s_flight_buffers;
+		while (FlightBuffer* buffer = link->load()) {
+			if (!buffer->owned && buffer->generation != generation) {
+				link->store(buffer->next.load());
+				delete[] buffer->data;
+				delete buffer;
+			} else {
+				link = &buffer->next;
+			}
+		}
+	}
+
+	// Gives this thread's buffer back when it exits.
+	struct FlightBufferOwner
+	{
+		~FlightBufferOwner()
+		{
+			std::lock_guard<std::mutex> lock(s_flight_mutex);
+			if (s_flight_buffer) {
+				s_flight_buffer->owned = false;
+				s_flight_buffer = nullptr;
+			}
+			flight_free_stale_buffers();
+		}
+	};
+
+	// Called the first time this thread logs to a (new) recorder. Returns nullptr if it was just removed.
+	static FlightBuffer* flight_claim_buffer()
+	{
+		// Plain thread_local, since it needs a destructor (LOGURU_THREAD_LOCAL may be __thread).
+		static thread_local FlightBufferOwner s_flight_buffer_owner;
+		(void)s_flight_buffer_owner;
+
+		std::lock_guard<std::mutex> lock(s_flight_mutex);
+		if (s_flight_buffer) {
+			s_flight_buffer->owned = false; // Made for an older recorder.
+			s_flight_buffer = nullptr;
+		}
+		flight_free_stale_buffers();
+		if (s_flight_verbosity.load() == Verbosity_OFF) { return nullptr; }
+
+		const unsigned generation = s_flight_generation.load();
+		FlightBuffer* buffer = nullptr;
+		for (FlightBuffer* it = s_flight_buffers.load(); it && !buffer; it = it->next.load()) {
+			if (!it->owned && it->generation == generation) { buffer = it; }
+		}
+		if (!buffer) {
+			buffer = new FlightBuffer();
+			buffer->data = new char[s_flight_buffer_size];
+			buffer->size = s_flight_buffer_size;
+			buffer->generation = generation;
+			buffer->next.store(s_flight_buffers.load());
+			s_flight_buffers.store(buffer);
+		}
+		buffer->owned = true;
+		get_thread_name(buffer->thread_name, sizeof(buffer->thread_name), false);
+		s_flight_buffer = buffer;
+		return buffer;
+	}
+
+	static void flight_copy(FlightBuffer& buffer, size_t pos, const char* data, size_t size)
+	{
+		const size_t offset = pos & (buffer.size - 1);
+		const size_t first = std::min(size, buffer.size - offset);
+		memcpy(buffer.data + offset, data, first);
+		memcpy(buffer.data, data + first, size - first);
+	}
+
+	// Records the message if the flight recorder wants it. Returns true if no other output does.
+	static bool flight_record(const Message& message, Preambles& preambles, bool with_indentation)
+	{
+		const Verbosity verbosity = static_cast<Verbosity>(s_flight_verbosity.load(std::memory_order_relaxed));
+		if (verbosity == Verbosity_OFF) { return false; }
+		const Verbosity out_verbosity = output_verbosity(message.verbosity, message.filename);
+		if (out_verbosity > verbosity) { return false; }
+
+		FlightBuffer* buffer = s_flight_buffer;
+		if (!buffer || buffer->generation != s_flight_generation.load(std::memory_order_relaxed)) {
+			buffer = flight_claim_buffer();
+			if (!buffer) { return false; }
+		}
+
+		const char* indent = with_indentation ? indentation(scope_depth(s_scope_depths, verbosity)) : "";
+		const char* preamble = preambles.get(Preamble_All);
+		const Chunk chunks[] = {
+			{ preamble,         strlen(preamble)         },
+			{ indent,           strlen(indent)           },
+			{ message.prefix,   strlen(message.prefix)   },
+			{ message.message,  strlen(message.message)  },
+		};
+		size_t total = 1;
+		for (const auto& chunk : chunks) { total += chunk.size; }
+		total = std::min(total, buffer->size); // Longer lines are cut.
+
+		// Like a seqlock: a dump that copies while we write sees that in 'reserved', and skips those bytes.
+		const size_t start = buffer->end.load(std::memory_order_relaxed);
+		buffer->reserved.store(start + total, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		size_t written = 0;
+		for (const auto& chunk : chunks) {
+			const size_t size = std::min(chunk.size, total - 1 - written);
+			flight_copy(*buffer, start + written, chunk.data, size);
+			written += size;
+		}
+		flight_copy(*buffer, start + written, "\n", 1);
+		buffer->end.store(start + total, std::memory_order_release);
+
+		return message.verbosity != Verbosity_FATAL && out_verbosity > g_stderr_verbosity
+			&& out_verbosity > static_cast<Verbosity>(s_outputs_verbosity.load(std::memory_order_relaxed));
+	}
+
+	static void flight_recorder_log(void*, const Message&) { } // Written by flight_record instead.
+
+	// Copies the whole lines that the buffer holds into 'scratch' (buffer.size bytes), and returns their size.
+	static size_t flight_copy_lines(const FlightBuffer& buffer, char* scratch, const char*& text)
+	{
+		const size_t end = buffer.end.load(std::memory_order_acquire);
+		const size_t size = std::min(end, buffer.size);
+		const size_t start = end - size;
+		const size_t offset = start & (buffer.size - 1);
+		const size_t first = std::min(size, buffer.size - offset);
+		memcpy(scratch, buffer.data + offset, first);
+		memcpy(scratch + first, buffer.data, size - first);
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		// The owner may have overwritten the oldest bytes while we copied.
+		const size_t reserved = buffer.reserved.load(std::memory_order_relaxed);
+		size_t skip = reserved > start + buffer.size ? reserved - buffer.size - start : 0;
+		if (skip >= size) { return 0; }
+		if (start + skip > 0) {
+			// Starts in the middle of a line.
+			const char* newline = static_cast<const char*>(memchr(scratch + skip, '\n', size - skip));
+			if (!newline) { return 0; }
+			skip = static_cast<size_t>(newline + 1 - scratch);
+		}
+		text = scratch + skip;
+		return size - skip;
+	}
+
+	// No locks or heap allocations, so the signal handler can use it too (best effort, without s_flight_mutex).
+	template<typename Write>
+	static void write_flight_recorder(char* scratch, Write write)
+	{
+		const unsigned generation = s_flight_generation.load();
+		for (const FlightBuffer* buffer = s_flight_buffers.load(); buffer; buffer = buffer->next.load()) {
+			if (buffer->generation != generation) { continue; }
+			const char* text = "";
+			const size_t size = flight_copy_lines(*buffer, scratch, text);
+			write("-------- thread ", 16);
+			write(buffer->thread_name, strnlen(buffer->thread_name, sizeof(buffer->thread_name)));
+			write(" --------\n", 10);
+			write(text, size);
+		}
+	}
+
+	static void flight_recorder_close(void*)
+	{
+		std::lock_guard<std::mutex> lock(s_flight_mutex);
+		s_flight_verbosity.store(Verbosity_OFF);
+		s_flight_path[0] = '\0';
+		s_flight_generation.fetch_add(1); // The threads free their buffers when they exit.
+		flight_free_stale_buffers();
+		delete[] s_flight_scratch;
+		s_flight_scratch = nullptr;
+	}
+
+	bool add_flight_recorder(const char* dump_path, Verbosity verbosity, size_t bytes_per_thread)
+	{
+		size_t size = 1024;
+		while (size < bytes_per_thread) { size *= 2; }
+		char path[PATH_MAX] = "";
+		if (dump_path && !expand_home(dump_path, path)) { return false; } // Before s_flight_mutex, since it may log.
+		{
+			std::lock_guard<std::mutex> lock(s_flight_mutex);
+			if (s_flight_verbosity.load() == Verbosity_OFF) {
+				memcpy(s_flight_path, path, sizeof(path));
+				s_flight_scratch = new char[size];
+				s_flight_buffer_size = size;
+				s_flight_generation.fetch_add(1);
+				flight_free_stale_buffers();
+				s_flight_verbosity.store(verbosity);
+				size = 0;
+			}
+		}
+		if (size != 0) {
+			LOG_F(ERROR, "Only one flight recorder is supported at a time");
+			return false;
+		}
+		if (dump_path && !mkpath(s_flight_path)) {
+			LOG_F(ERROR, "Failed to create directories to '%s'", s_flight_path);
+		}
+		// For the verbosity cutoff, remove_callback and shutdown().
+		add_callback("flight_recorder", flight_recorder_log, nullptr, verbosity, flight_recorder_close, nullptr);
+		return true;
+	}
+
+	bool dump_flight_recorder(const char* path_in)
+	{
+		if (s_flight_verbosity.load() == Verbosity_OFF) {
+			LOG_F(ERROR, "Can't dump to '%s': there is no flight recorder", path_in);
+			return false;
+		}
+
+		char path[PATH_MAX];
+		if (!expand_home(path_in, path)) { return false; }
+		FILE* file = open_log_file(path, "wb");
+		if (!file) {
+			LOG_F(ERROR, "Failed to open '%s'", path);
+			return false;
+		}
+		{
+			// No logging in here: it could need a buffer, and so s_flight_mutex.
+			std::lock_guard<std::mutex> lock(s_flight_mutex);
+			std::unique_ptr<char[]> scratch(new char[s_flight_buffer_size]);
+			write_flight_recorder(scratch.get(), [file](const char* data, size_t size) {
+				fwrite(data, 1, size, file);
+			});
+		}
+		fclose(file);
+		return true;
+	}
+
+	// ------------------------------------------------------------------------
+
+	// stack_trace_skip is just if verbosity == FATAL.
+	static void dispatch_message(int stack_trace_skip, const PreambleInfo& preamble, Message& message,
+		bool with_indentation, bool abort_if_fatal)
+	{
+		Preambles preambles(preamble);
+		mapped_file_write(message, preambles, with_indentation);
+		if (flight_record(message, preambles, with_indentation)) {
+			return; // Only for the flight recorder.
+		}
+
+		if (message.verbosity != Verbosity_FATAL) {
+			if (async_push(message, preamble, with_indentation)) {
+				return;
+			}
+			WritingScope writing;
+			write_message_to_thread_safe_callbacks(message, preambles, with_indentation, s_scope_depths);
+		}
+
+		std::unique_lock<std::recursive_mutex> lock(s_mutex, std::try_to_lock);
+		if (!lock.owns_lock()) {
+			const long long start_ns = now_ns();
+			lock.lock();
+			stats_add(stats_shard().lock_wait_ns, now_ns() - start_ns);
+		}
+
+		if (message.verbosity == Verbosity_FATAL) {
+			async_drain_all();
+		}
+
+		WritingScope writing;
+
+		if (message.verbosity == Verbosity_FATAL) {
+			const auto st = format_stacktrace(stack_trace_skip + 2, true);
+			if (!st.empty()) {
+				RAW_LOG_F(ERROR, "Stack trace:\n%s", st.c_str());
+			}
+
+			char ec[4096];
+			const size_t ec_size = loguru::write_error_context(ec, sizeof(ec));
+			if (ec_size >= sizeof(ec)) {
+				RAW_LOG_F(ERROR, "%s", loguru::get_error_context().c_str());
+			}
+			else if (ec_size > 0) {
+				RAW_LOG_F(ERROR, "%s", ec);
+			}
+		}
+
+		write_message(message, preambles, with_indentation, s_scope_depths, message.verbosity == Verbosity_FATAL);
+
+		if (message.verbosity == Verbosity_FATAL) {
+			flush();
+			if (s_flight_path[0]) {
+				dump_flight_recorder(s_flight_path);
+			}
+
+			if (s_fatal_handler) {
+				message.preamble = preambles.get(Preamble_All);
+				s_fatal_handler(message);
+				flush();
+			}
+
+			if (abort_if_fatal) {
+#if LOGURU_CATCH_SIGABRT && !defined(_WIN32)
+				// Make sure we don't catch our own abort:
+				signal(SIGABRT, SIG_DFL);
+#endif
+				abort();
+			}
+		}
+	}
+
+	// ------------------------------------------------------------------------
+	// Suppression of repeated messages (g_dedup_window_ms):
+
+	struct DedupState
+	{
+		uint64_t           hash = 0;     // Of the last message written. 0 for none.
+		long long          time_ns = 0;  // When it was written.
+		unsigned long long repeats = 0;  // Dropped since.
+		Verbosity          verbosity = Verbosity_INFO;
+		const char*        file = "";
+		unsigned           line = 0;
+		std::string        text;         // prefix + message, to compare with and for the summary. Keeps its capacity.
+	};
+
+	static DedupState s_dedup;
+	static std::mutex s_dedup_mutex;
+
+	// The hash only rules out most other messages: a collision must not drop a different one.
+	static bool dedup_matches(const DedupState& state, uint64_t hash, const Message& message, size_t prefix_size)
+	{
+		if (hash != state.hash || message.filename != state.file || message.line != state.line) { return false; }
+		return state.text.size() >= prefix_size
+			&& state.text.compare(0, prefix_size, message.prefix) == 0
+			&& strcmp(state.text.c_str() + prefix_size, message.message) == 0;
+	}
+
+	static uint64_t dedup_hash(const Message& message)
+	{
+		uint64_t hash = 14695981039346656037ull; // FNV-1a
+		const auto add = [&](const char* str) {
+			for (; *str; ++str) { hash = (hash ^ static_cast<unsigned char>(*str)) * 1099511628211ull; }
+		};
+		add(message.prefix);
+		add(message.message);
+		hash ^= reinterpret_cast<uintptr_t>(message.filename) * 31 + message.line;
+		return hash ? hash : 1;
+	}
+
+	static void dedup_write_summary(const DedupState& state, unsigned long long repeats)
+	{
+		char prefix[64];
+		snprintf(prefix, sizeof(prefix), "(repeated %llu more times) ", repeats);
+		PreambleInfo info;
+		make_preamble_info(info, state.verbosity, state.file, state.line);
+		auto message = Message{ state.verbosity, state.file, state.line, "", "", prefix, state.text.c_str(), nullptr, 0,
+			info.ms_since_epoch };
+		dispatch_message(1, info, message, true, false);
+	}
+
+	// Returns true if the message repeats the last one and should be dropped.
+	// The window starts at the message that was written, so a message that keeps repeating
+	// is written again (after its count) once per window.
+	static bool dedup_is_repeat(const Message& message)
+	{
+		const uint64_t hash = dedup_hash(message);
+		const size_t prefix_size = strlen(message.prefix);
+		const long long now = now_ns();
+		const long long window_ns = static_cast<long long>(g_dedup_window_ms) * 1000000;
+
+		DedupState previous;
+		unsigned long long repeats;
+		{
+			std::lock_guard<std::mutex> lock(s_dedup_mutex);
+			if (now - s_dedup.time_ns < window_ns && dedup_matches(s_dedup, hash, message, prefix_size)) {
+				++s_dedup.repeats;
+				return true;
+			}
+			repeats = s_dedup.repeats;
+			if (repeats > 0) { previous = s_dedup; }
+			s_dedup.hash = hash;
+			s_dedup.time_ns = now;
+			s_dedup.repeats = 0;
+			s_dedup.verbosity = message.verbosity;
+			s_dedup.file = message.filename;
+			s_dedup.line = message.line;
+			s_dedup.text.assign(message.prefix, prefix_size).append(message.message);
+		}
+		if (repeats > 0) {
+			dedup_write_summary(previous, repeats);
+		}
+		return false;
+	}
+
+	// Writes the count of dropped repeats, if any. Called by flush().
+	static void flush_dedup()
+	{
+		DedupState previous;
+		unsigned long long repeats;
+		{
+			std::lock_guard<std::mutex> lock(s_dedup_mutex);
+			repeats = s_dedup.repeats;
+			if (repeats == 0) { return; }
+			previous = s_dedup;
+			s_dedup.repeats = 0;
+		}
+		dedup_write_summary(previous, repeats);
+	}
+
+	// stack_trace_skip is just if verbosity == FATAL.
+	static void log_message(int stack_trace_skip, const PreambleInfo& preamble, Message& message,
+		bool with_indentation, bool abort_if_fatal)
+	{
+		const int index = std::min(std::max(static_cast<int>(message.verbosity), static_cast<int>(Verbosity_FATAL)),
+			static_cast<int>(Verbosity_MAX)) - Verbosity_FATAL;
+		stats_shard().messages[index].fetch_add(1, std::memory_order_relaxed);
+		if (s_stats_flush.interval_ms.load(std::memory_order_relaxed) > 0 && !s_thread_is_logging_stats) {
+			mark_dirty(s_stats_flush);
+		}
+
+		if (g_dedup_window_ms > 0 && message.verbosity != Verbosity_FATAL && dedup_is_repeat(message)) {
+			return;
+		}
+		dispatch_message(stack_trace_skip + 1, preamble, message, with_indentation, abort_if_fatal);
+	}
+
+	// stack_trace_skip is just if verbosity == FATAL.
+	void log_to_everywhere(int stack_trace_skip, Verbosity verbosity,
+		const char* file, unsigned line,
+		const char* prefix, const char* buff)
+	{
+		PreambleInfo preamble;
+		make_preamble_info(preamble, verbosity, file, line);
+		auto message = Message{ verbosity, file, line, "", "", prefix, buff, nullptr, 0, preamble.ms_since_epoch };
+		log_message(stack_trace_skip + 1, preamble, message, true, true);
+	}
+
+	static bool is_level_on(Verbosity verbosity)
+	{
+		switch (verbosity) {
+			case Verbosity_ERROR:   return is_filter_on(Filter_ErrorOn);
+			case Verbosity_WARNING: return is_filter_on(Filter_WarningOn);
+			case Verbosity_INFO:    return is_filter_on(Filter_InfoOn);
+			default:                return true;
+		}
+	}
+
+	void log(Verbosity verbosity, const char* file, unsigned line, const char* format, ...)
+	{
+		if (!is_level_on(verbosity)) { return; }
+
+		va_list vlist;
+		va_start(vlist, format);
+		FormatBuffer buff(format, vlist);
+		va_end(vlist);
+		log_to_everywhere(1, verbosity, file, line, "", buff.c_str());
+	}
+
+	void log_rate_limited(long long num_suppressed, Verbosity verbosity, const char* file, unsigned line,
+		const char* format, ...)
+	{
+		if (!is_level_on(verbosity)) { return; }
+
+		va_list vlist;
+		va_start(vlist, format);
+		FormatBuffer buff(format, vlist);
+		va_end(vlist);
+		char prefix[48] = "";
+		if (num_suppressed > 0) {
+			snprintf(prefix, sizeof(prefix), "(%lld suppressed) ", num_suppressed);
+		}
+		log_to_everywhere(1, verbosity, file, line, prefix, buff.c_str());
+	}
+
+	long long RateLimit::every_t(double seconds)
+	{
+		const long long now = now_ns();
+		long long next = next_ns.load(std::memory_order_relaxed);
+		if (now < next || !next_ns.compare_exchange_strong(next, now + static_cast<long long>(seconds * 1e9),
+			std::memory_order_relaxed)) {
+			suppressed.fetch_add(1, std::memory_order_relaxed);
+			return -1;
+		}
+		return static_cast<long long>(suppressed.exchange(0, std::memory_order_relaxed));
+	}
+
+	void log_fields(Verbosity verbosity, const char* file, unsigned line, const Field* fields, size_t num_fields)
+	{
+		if (!is_level_on(verbosity)) { return; }
+
+		// For the text outputs: the msg, then logfmt.
+		TextBuffer text;
+		text += fields[0].value.s;
+		for (size_t i = 1; i < num_fields; ++i) {
+			text += ' ';
+			text += fields[i].key;
+			text += '=';
+			append_field_value(text, fields[i], Format_Logfmt);
+		}
+
+		PreambleInfo preamble;
+		make_preamble_info(preamble, verbosity, file, line);
+		auto message = Message{ verbosity, file, line, "", "", "", text.c_str(), fields, num_fields, preamble.ms_since_epoch };
+		log_message(1, preamble, message, true, true);
+	}
+
+	void raw_log(Verbosity verbosity, const char* file, unsigned line, const char* format, ...)
+	{
+		va_list vlist;
+		va_start(vlist, format);
+		FormatBuffer buff(format, vlist);
+		va_end(vlist);
+		const long long ms_since_epoch = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+		const PreambleInfo preamble = { Preamble_None, verbosity, file, line, ms_since_epoch, 0, "", 0 };
+		auto message = Message{ verbosity, file, line, "", "", "", buff.c_str(), nullptr, 0, ms_since_epoch };
+		log_message(1, preamble, message, false, true);
+	}
+
+	// ------------------------------------------------------------------------
+	// Binary logging:
+
+	/* File layout, in native byte order:
+		"LOGURUB1", followed by records. Each record starts with a one byte kind:
+		'S' site:    u32 site_id, u32 line, u16 length, file, u16 length, format
+		'T' thread:  u32 thread_id, u16 length, name
+		'M' message: u32 site_id, u32 thread_id, i32 verbosity, i64 ms_since_epoch, i64 uptime_ms,
+		             u16 length, arguments
+		Each argument is a one byte type followed by the value:
+		'i' 32-bit integer, 'l' 64-bit integer, 'd' double, 'p' 64-bit pointer, 's' u16 length + chars.
+		A site or thread is always written before the first message that refers to it.
+		Appending a new run to a file simply redefines the ids.
+	*/
+	const char BINARY_MAGIC[] = "LOGURUB1";
+
+	struct BinarySiteInfo
+	{
+		unsigned id;
+		unsigned generation; // Of the file it was last written to.
+	};
+
+	static std::mutex             s_binary_mutex;
+	static FILE*                  s_binary_file = nullptr;
+	static std::atomic<Verbosity> s_binary_verbosity{ Verbosity_OFF };
+	static unsigned               s_binary_generation = 0; // Incremented for each opened file.
+	static std::unordered_map<const BinarySite*, BinarySiteInfo> s_binary_sites;
+
+	static void binary_append_value(BinaryArgs& args, char type, const void* value, size_t size)
+	{
+		if (args.full || args.size + 1 + size > sizeof(args.data)) {
+			args.full = true;
+			return;
+		}
+		args.data[args.size] = type;
+		memcpy(args.data + args.size + 1, value, size);
+		args.size += static_cast<unsigned>(1 + size);
+	}
+
+	static void binary_append_integer(BinaryArgs& args, long long value, size_t size)
+	{
+		if (size <= 4) {
+			const int32_t value_32 = static_cast<int32_t>(value);
+			binary_append_value(args, 'i', &value_32, sizeof(value_32));
+		}
+		else {
+			const int64_t value_64 = static_cast<int64_t>(value);
+			binary_append_value(args, 'l', &value_64, sizeof(value_64));
+		}
+	}
+
+	void binary_append(BinaryArgs& args, int value)                { binary_append_integer(args, value, sizeof(value)); }
+	void binary_append(BinaryArgs& args, unsigned int value)       { binary_append_integer(args, value, sizeof(value)); }
+	void binary_append(BinaryArgs& args, long value)               { binary_append_integer(args, value, sizeof(value)); }
+	void binary_append(BinaryArgs& args, unsigned long value)      { binary_append_integer(args, static_cast<long long>(value), sizeof(value)); }
+	void binary_append(BinaryArgs& args, long long value)          { binary_append_integer(args, value, sizeof(value)); }
+	void binary_append(BinaryArgs& args, unsigned long long value) { binary_append_integer(args, static_cast<long long>(value), sizeof(value)); }
+
+	void binary_append(BinaryArgs& args, double value)
+	{
+		binary_append_value(args, 'd', &value, sizeof(value));
+	}
+
+	void binary_append(BinaryArgs& args, long double value)
+	{
+		binary_append(args, static_cast<double>(value));
+	}
+
+	void binary_append(BinaryArgs& args, const void* value)
+	{
+		const uint64_t address = reinterpret_cast<uintptr_t>(value);
+		binary_append_value(args, 'p', &address, sizeof(address));
+	}
+
+	void binary_append(BinaryArgs& args, const char* value)
+	{
+		if (!value) { value = "(null)"; }
+		const size_t room = sizeof(args.data) - args.size;
+		if (args.full || room < 1 + sizeof(uint16_t)) {
+			args.full = true;
+			return;
+		}
+		const uint16_t length = static_cast<uint16_t>(std::min(strlen(value), room - 1 - sizeof(uint16_t)));
+		char* out = args.data + args.size;
+		*out++ = 's';
+		memcpy(out, &length, sizeof(length));
+		memcpy(out + sizeof(length), value, length);
+		args.size += static_cast<unsigned>(1 + sizeof(length) + length);
+	}
+
+	static void binary_put(std::string& out, const void* data, size_t size)
+	{
+		out.append(static_cast<const char*>(data), size);
+	}
+
+	static void binary_put_string(std::string& out, const char* str)
+	{
+		const uint16_t length = static_cast<uint16_t>(std::min<size_t>(strlen(str), 0xffff));
+		binary_put(out, &length, sizeof(length));
+		binary_put(out, str, length);
+	}
+
+	// Must be called with s_binary_mutex locked.
+	static unsigned binary_site_id(const BinarySite& site)
+	{
+		BinarySiteInfo& info = s_binary_sites[&site];
+		if (info.id == 0) {
+			info.id = static_cast<unsigned>(s_binary_sites.size());
+		}
+		if (info.generation != s_binary_generation) {
+			const uint32_t id = info.id, line = site.line;
+			std::string record = "S";
+			binary_put(record, &id, sizeof(id));
+			binary_put(record, &line, sizeof(line));
+			binary_put_string(record, site.file);
+			binary_put_string(record, site.format);
+			fwrite(record.data(), 1, record.size(), s_binary_file);
+			info.generation = s_binary_generation;
 		}
+		return info.id;
+	}
 
-		if (g_flush_interval_ms > 0 && !s_flush_thread) {
-			s_flush_thread = new std::thread([]() {
-				for (;;) {
-					if (s_needs_flushing) {
-						flush();
-					}
-					std::this_thread::sleep_for(std::chrono::milliseconds(g_flush_interval_ms));
-				}
-			});
+	// Must be called with s_binary_mutex locked.
+	static unsigned binary_thread_id()
+	{
+		const uint32_t id = get_thread_index();
+		if (s_binary_thread_generation != s_binary_generation) {
+			std::string record = "T";
+			binary_put(record, &id, sizeof(id));
+			binary_put_string(record, cached_thread_name());
+			fwrite(record.data(), 1, record.size(), s_binary_file);
+			s_binary_thread_generation = s_binary_generation;
 		}
+		return id;
+	}
 
-		if (message.verbosity == Verbosity_FATAL) {
-			flush();
+	void write_binary(const BinarySite& site, Verbosity verbosity, const BinaryArgs& args)
+	{
+		const int64_t ms_since_epoch = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+		const int64_t uptime_ms = duration_cast<milliseconds>(steady_clock::now() - s_start_time).count();
+
+		std::lock_guard<std::mutex> lock(s_binary_mutex);
+		if (!s_binary_file || verbosity > s_binary_verbosity.load(std::memory_order_relaxed)) { return; }
+
+		const uint32_t site_id = binary_site_id(site);
+		const uint32_t thread_id = binary_thread_id();
+		const int32_t verbosity_32 = verbosity;
+		const uint16_t args_size = static_cast<uint16_t>(args.size);
+
+		char record[1 + 3 * 4 + 2 * 8 + 2 + sizeof(args.data)];
+		char* out = record;
+		*out++ = 'M';
+		memcpy(out, &site_id, 4);         out += 4;
+		memcpy(out, &thread_id, 4);       out += 4;
+		memcpy(out, &verbosity_32, 4);    out += 4;
+		memcpy(out, &ms_since_epoch, 8);  out += 8;
+		memcpy(out, &uptime_ms, 8);       out += 8;
+		memcpy(out, &args_size, 2);       out += 2;
+		memcpy(out, args.data, args_size); out += args_size;
+		fwrite(record, 1, static_cast<size_t>(out - record), s_binary_file);
+	}
 
-			if (s_fatal_handler) {
-				s_fatal_handler(message);
-				flush();
-			}
+	bool open_binary_file(const char* path_in, FileMode mode, Verbosity verbosity)
+	{
+		char path[PATH_MAX];
+		if (!expand_home(path_in, path)) { return false; }
 
-			if (abort_if_fatal) {
-#if LOGURU_CATCH_SIGABRT && !defined(_WIN32)
-				// Make sure we don't catch our own abort:
-				signal(SIGABRT, SIG_DFL);
+		if (!mkpath(path)) {
+			LOG_F(ERROR, "Failed to create directories to '%s'", path);
+		}
+
+		const char* mode_str = (mode == FileMode::Truncate ? "wb" : "ab");
+		FILE* file = nullptr;
+#ifdef _WIN32
+		file = _fsopen(path, mode_str, _SH_DENYWR);
+#else
+		file = fopen(path, mode_str);
 #endif
-				abort();
-			}
+		if (!file) {
+			LOG_F(ERROR, "Failed to open '%s'", path);
+			return false;
+		}
+		setvbuf(file, nullptr, _IOFBF, 64 * 1024);
+		fseek(file, 0, SEEK_END);
+		if (ftell(file) == 0) {
+			fwrite(BINARY_MAGIC, 1, sizeof(BINARY_MAGIC) - 1, file);
 		}
+
+		close_binary_file();
+		std::lock_guard<std::mutex> lock(s_binary_mutex);
+		s_binary_file = file;
+		s_binary_generation += 1;
+		s_binary_verbosity.store(verbosity);
+		return true;
 	}
 
-	// stack_trace_skip is just if verbosity == FATAL.
-	void log_to_everywhere(int stack_trace_skip, Verbosity verbosity,
-		const char* file, unsigned line,
-		const char* prefix, const char* buff)
+	void close_binary_file()
 	{
-		char preamble_buff[128];
-		print_preamble(preamble_buff, sizeof(preamble_buff), verbosity, file, line);
-		auto message = Message{ verbosity, file, line, preamble_buff, "", prefix, buff };
-		log_message(stack_trace_skip + 1, message, true, true);
+		std::lock_guard<std::mutex> lock(s_binary_mutex);
+		if (s_binary_file) {
+			fclose(s_binary_file);
+			s_binary_file = nullptr;
+		}
+		s_binary_verbosity.store(Verbosity_OFF);
 	}
 
-	void log(Verbosity verbosity, const char* file, unsigned line, const char* format, ...)
+	Verbosity binary_verbosity_cutoff()
 	{
-    switch (verbosity)
-    {
-    case Verbosity_ERROR:
-      if (!error_on)
-        return;
-      break;
-    case Verbosity_WARNING:
-      if (!warning_on)
-        return;
-      break;
-    case Verbosity_INFO:
-      if (!info_on)
-        return;
-      break;
-    default:
-      break;
-    }
-
-		va_list vlist;
-		va_start(vlist, format);
-		auto buff = vtextprintf(format, vlist);
-		log_to_everywhere(1, verbosity, file, line, "", buff.c_str());
-		va_end(vlist);
+		return s_binary_verbosity.load(std::memory_order_relaxed);
 	}
 
-	void raw_log(Verbosity verbosity, const char* file, unsigned line, const char* format, ...)
+	static void flush_binary_file()
 	{
-		va_list vlist;
-		va_start(vlist, format);
-		auto buff = vtextprintf(format, vlist);
-		auto message = Message{ verbosity, file, line, "", "", "", buff.c_str() };
-		log_message(1, message, false, true);
-		va_end(vlist);
+		std::lock_guard<std::mutex> lock(s_binary_mutex);
+		if (s_binary_file) {
+			fflush(s_binary_file);
+		}
 	}
 
+	// ------------------------------------------------------------------------
+
 	void flush()
 	{
+		flush_dedup();
 		std::lock_guard<std::recursive_mutex> lock(s_mutex);
+		async_drain_all();
+		s_stderr_flush.dirty_since_ns.store(0);
 		fflush(stderr);
-		for (const auto& callback : s_callbacks)
-		{
-			if (callback.flush) {
-				callback.flush(callback.user_data);
+		s_stats.stderr_stats.flushes.fetch_add(1, std::memory_order_relaxed);
+		if (const CallbackList* list = s_callbacks.load()) {
+			for (const auto& callback : list->callbacks)
+			{
+				if (callback.flush) {
+					callback.flush_state->dirty_since_ns.store(0);
+					call_flush(callback);
+				}
 			}
 		}
-		s_needs_flushing = false;
+		flush_binary_file();
 	}
 
 	LogScopeRAII::LogScopeRAII(Verbosity verbosity, const char* file, unsigned line, const char* format, ...)
 		: _verbosity(verbosity), _file(file), _line(line)
 	{
-		if (verbosity <= current_verbosity_cutoff()) {
-			std::lock_guard<std::recursive_mutex> lock(s_mutex);
-			_indent_stderr = (verbosity <= g_stderr_verbosity);
+		const Verbosity out_verbosity = output_verbosity(verbosity, file);
+		if (out_verbosity <= current_verbosity_cutoff()) {
+			_out_verbosity = out_verbosity;
 			_start_time_ns = now_ns();
 			va_list vlist;
 			va_start(vlist, format);
 			vsnprintf(_name, sizeof(_name), format, vlist);
 			log_to_everywhere(1, _verbosity, file, line, "{ ", _name);
 			va_end(vlist);
-
-			if (_indent_stderr) {
-				++s_stderr_indentation;
-			}
-
-			for (auto& p : s_callbacks) {
-				if (verbosity <= p.verbosity) {
-					++p.indentation;
-				}
-			}
+			enter_scope(out_verbosity);
 		}
 		else {
 			_file = nullptr;
@@ -1356,31 +4889,144 @@ namespace loguru
 	LogScopeRAII::~LogScopeRAII()
 	{
 		if (_file) {
-			std::lock_guard<std::recursive_mutex> lock(s_mutex);
-			if (_indent_stderr && s_stderr_indentation > 0) {
-				--s_stderr_indentation;
-			}
-			for (auto& p : s_callbacks) {
-				// Note: Callback indentation cannot change!
-				if (_verbosity <= p.verbosity) {
-					// in unlikely case this callback is new
-					if (p.indentation > 0) {
-						--p.indentation;
-					}
-				}
-			}
+			leave_scope(_out_verbosity);
 			auto duration_sec = (now_ns() - _start_time_ns) / 1e9;
 			log(_verbosity, _file, _line, "} %.*f s: %s", SCOPE_TIME_PRECISION, duration_sec, _name);
 		}
 	}
 
+	// ------------------------------------------------------------------------
+	// Scope timing (LOG_SCOPE_TIMING):
+	// A log-linear histogram per call site. Each power of two is split into 8 buckets, so a bucket is within 12.5%.
+
+	const unsigned SCOPE_TIMING_SUB_BITS    = 3;
+	const unsigned SCOPE_TIMING_SUB_BUCKETS = 1u << SCOPE_TIMING_SUB_BITS;
+	const unsigned SCOPE_TIMING_MAX_BITS    = 48; // About 78 hours in ns. Longer durations go in the last bucket.
+	const unsigned SCOPE_TIMING_BUCKETS     = (SCOPE_TIMING_MAX_BITS - SCOPE_TIMING_SUB_BITS + 1) * SCOPE_TIMING_SUB_BUCKETS;
+
+	struct ScopeTiming
+	{
+		const char*                     name;
+		const char*                     file;
+		unsigned                        line;
+		std::atomic<unsigned long long> buckets[SCOPE_TIMING_BUCKETS];
+		std::atomic<unsigned long long> max_ns;
+		ScopeTiming*                    next; // All sites, newest first.
+	};
+
+	static std::atomic<ScopeTiming*> s_scope_timings{ nullptr };
+
+	static unsigned highest_bit(unsigned long long value)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		return 63u - static_cast<unsigned>(__builtin_clzll(value));
+#else
+		unsigned bit = 0;
+		while (value >>= 1) { ++bit; }
+		return bit;
+#endif
+	}
+
+	static unsigned scope_timing_bucket(unsigned long long ns)
+	{
+		ns = std::min(ns, (1ull << SCOPE_TIMING_MAX_BITS) - 1);
+		if (ns < SCOPE_TIMING_SUB_BUCKETS) { return static_cast<unsigned>(ns); }
+		const unsigned shift = highest_bit(ns) - SCOPE_TIMING_SUB_BITS;
+		return (shift + 1) * SCOPE_TIMING_SUB_BUCKETS + static_cast<unsigned>((ns >> shift) & (SCOPE_TIMING_SUB_BUCKETS - 1));
+	}
+
+	// The middle of the range of durations that go in the bucket.
+	static unsigned long long scope_timing_bucket_value(unsigned bucket)
+	{
+		if (bucket < SCOPE_TIMING_SUB_BUCKETS) { return bucket; }
+		const unsigned shift = bucket / SCOPE_TIMING_SUB_BUCKETS - 1;
+		const unsigned long long lowest = static_cast<unsigned long long>(SCOPE_TIMING_SUB_BUCKETS + bucket % SCOPE_TIMING_SUB_BUCKETS) << shift;
+		return lowest + ((1ull << shift) >> 1);
+	}
+
+	ScopeTiming* register_scope_timing(const char* name, const char* file, unsigned line)
+	{
+		auto site = new ScopeTiming(); // Zeroes the histogram.
+		site->name = name;
+		site->file = file;
+		site->line = line;
+		site->next = s_scope_timings.load();
+		while (!s_scope_timings.compare_exchange_weak(site->next, site)) { }
+		return site;
+	}
+
+	ScopeTimer::ScopeTimer(ScopeTiming* site) : _site(site), _start_time_ns(site ? now_ns() : 0)
+	{
+	}
+
+	ScopeTimer::~ScopeTimer()
+	{
+		if (!_site) { return; }
+		const long long duration_ns = now_ns() - _start_time_ns;
+		const unsigned long long ns = duration_ns > 0 ? static_cast<unsigned long long>(duration_ns) : 0;
+		_site->buckets[scope_timing_bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+		unsigned long long max_ns = _site->max_ns.load(std::memory_order_relaxed);
+		while (ns > max_ns && !_site->max_ns.compare_exchange_weak(max_ns, ns, std::memory_order_relaxed)) { }
+	}
+
+	static void write_duration(char* buff, size_t buff_size, unsigned long long ns)
+	{
+		if (ns < 1000) {
+			snprintf(buff, buff_size, "%llu ns", ns);
+		} else if (ns < 1000 * 1000) {
+			snprintf(buff, buff_size, "%.1f us", ns / 1e3);
+		} else if (ns < 1000 * 1000 * 1000) {
+			snprintf(buff, buff_size, "%.1f ms", ns / 1e6);
+		} else {
+			snprintf(buff, buff_size, "%.2f s", ns / 1e9);
+		}
+	}
+
+	void log_scope_timings(Verbosity verbosity, bool reset)
+	{
+		for (ScopeTiming* site = s_scope_timings.load(); site; site = site->next) {
+			unsigned long long counts[SCOPE_TIMING_BUCKETS];
+			unsigned long long count = 0;
+			for (unsigned i = 0; i < SCOPE_TIMING_BUCKETS; ++i) {
+				counts[i] = reset ? site->buckets[i].exchange(0, std::memory_order_relaxed)
+				                  : site->buckets[i].load(std::memory_order_relaxed);
+				count += counts[i];
+			}
+			const unsigned long long max_ns = reset ? site->max_ns.exchange(0, std::memory_order_relaxed)
+			                                        : site->max_ns.load(std::memory_order_relaxed);
+			if (count == 0) { continue; }
+
+			// The smallest durations with at least half (99%) of the calls at or below them.
+			unsigned long long p50_ns = max_ns, p99_ns = max_ns, seen = 0;
+			bool p50_found = false;
+			for (unsigned i = 0; i < SCOPE_TIMING_BUCKETS; ++i) {
+				seen += counts[i];
+				if (!p50_found && 2 * seen >= count) {
+					p50_ns = scope_timing_bucket_value(i);
+					p50_found = true;
+				}
+				if (100 * seen >= 99 * count) {
+					p99_ns = scope_timing_bucket_value(i);
+					break;
+				}
+			}
+
+			char p50[32], p99[32], max[32];
+			write_duration(p50, sizeof(p50), std::min(p50_ns, max_ns));
+			write_duration(p99, sizeof(p99), std::min(p99_ns, max_ns));
+			write_duration(max, sizeof(max), max_ns);
+			log(verbosity, site->file, site->line, "Scope timing: %s: %llu calls, p50 %s, p99 %s, max %s",
+				site->name, count, p50, p99, max);
+		}
+	}
+
 	void log_and_abort(int stack_trace_skip, const char* expr, const char* file, unsigned line, const char* format, ...)
 	{
 		va_list vlist;
 		va_start(vlist, format);
-		auto buff = vtextprintf(format, vlist);
-		log_to_everywhere(stack_trace_skip + 1, Verbosity_FATAL, file, line, expr, buff.c_str());
+		FormatBuffer buff(format, vlist);
 		va_end(vlist);
+		log_to_everywhere(stack_trace_skip + 1, Verbosity_FATAL, file, line, expr, buff.c_str());
 		abort(); // log_to_everywhere already does this, but this makes the analyzer happy.
 	}
 
@@ -1410,16 +5056,131 @@ namespace loguru
 
 #if LOGURU_WITH_STREAMS
 
+	// Keeps the text in a string we can reuse and read without copying it out (like std::stringbuf::str() would).
+	class LogStreamBuf : public std::streambuf
+	{
+	public:
+		const char* c_str() const { return _text.c_str(); }
+
+		void clear()
+		{
+			if (_text.capacity() > 64 * 1024) {
+				std::string().swap(_text); // Don't hold on to the memory of one huge message.
+			} else {
+				_text.clear();
+			}
+		}
+
+	protected:
+		int_type overflow(int_type c) override
+		{
+			if (!traits_type::eq_int_type(c, traits_type::eof())) {
+				_text += traits_type::to_char_type(c);
+			}
+			return traits_type::not_eof(c);
+		}
+
+		std::streamsize xsputn(const char* s, std::streamsize n) override
+		{
+			_text.append(s, static_cast<size_t>(n));
+			return n;
+		}
+
+	private:
+		std::string _text;
+	};
+
+	class LogStream : public std::ostream
+	{
+	public:
+		LogStream() : std::ostream(&_buf) {}
+
+		const char* c_str() const { return _buf.c_str(); }
+
+		// Forget the text, and anything like std::hex or std::setprecision the last user left behind.
+		void reset()
+		{
+			_buf.clear();
+			std::ostream::clear();
+			flags(std::ios_base::skipws | std::ios_base::dec);
+			precision(6);
+			width(0);
+			fill(' ');
+		}
+
+	private:
+		LogStreamBuf _buf;
+	};
+
+	// One stream per nesting level (a LOG_S in an operator<< of something being LOG_S:ed gets its own).
+	// Set once the pool of this thread is destroyed: a LOG_S from a later thread_local destructor gets a stream of its own.
+	static LOGURU_THREAD_LOCAL bool s_log_stream_pool_destroyed = false;
+
+	struct LogStreamPool
+	{
+		std::vector<LogStream*> free_streams;
+
+		~LogStreamPool()
+		{
+			s_log_stream_pool_destroyed = true;
+			for (auto stream : free_streams) {
+				delete stream;
+			}
+		}
+	};
+
+	// Plain thread_local, since the pool needs a destructor (LOGURU_THREAD_LOCAL may be __thread).
+	static thread_local LogStreamPool s_log_stream_pool;
+
+	std::ostream& acquire_log_stream()
+	{
+		if (s_log_stream_pool_destroyed) {
+			return *new LogStream();
+		}
+		auto& free_streams = s_log_stream_pool.free_streams;
+		if (free_streams.empty()) {
+			return *new LogStream();
+		}
+		LogStream* stream = free_streams.back();
+		free_streams.pop_back();
+		return *stream;
+	}
+
+	void release_log_stream(std::ostream& stream)
+	{
+		LogStream& log_stream = static_cast<LogStream&>(stream);
+		if (s_log_stream_pool_destroyed) {
+			delete &log_stream;
+			return;
+		}
+		log_stream.reset();
+		s_log_stream_pool.free_streams.push_back(&log_stream);
+	}
+
+	// Hands the stream back even if a fatal handler throws.
+	class LogStreamReleaser
+	{
+	public:
+		explicit LogStreamReleaser(std::ostream& stream) : _stream(stream) {}
+		~LogStreamReleaser() { release_log_stream(_stream); }
+
+	private:
+		std::ostream& _stream;
+	};
+
 	StreamLogger::~StreamLogger() noexcept(false)
 	{
-		auto message = _ss.str();
-		log(_verbosity, _file, _line, "%s", message.c_str());
+		LogStreamReleaser releaser(_ss);
+		if (is_level_on(_verbosity)) {
+			// 0, not 1 as in log(): there is no log() frame to skip, so the trace starts here as before.
+			log_to_everywhere(0, _verbosity, _file, _line, "", static_cast<LogStream&>(_ss).c_str());
+		}
 	}
 
 	AbortLogger::~AbortLogger() noexcept(false)
 	{
-		auto message = _ss.str();
-		loguru::log_and_abort(1, _expr, _file, _line, "%s", message.c_str());
+		LogStreamReleaser releaser(_ss);
+		loguru::log_and_abort(1, _expr, _file, _line, "%s", static_cast<LogStream&>(_ss).c_str());
 	}
 
 #endif // LOGURU_WITH_STREAMS
@@ -1431,15 +5192,52 @@ namespace loguru
 	// 888888 88  Yb 88  Yb  YbodP  88  Yb      YboodP  YbodP  88  Y8   88   888888 dP  Yb   88
 	// ----------------------------------------------------------------------------
 
+	// Writes into a fixed buffer, so rendering the error context never allocates.
 	struct StringStream
 	{
-		std::string str;
+		char*  buff;
+		size_t capacity;
+		size_t size;    // Of the whole text. More than fits in 'capacity' if it was cut short.
+		bool   compact; // All on one line, for LOG_F_WITH_CONTEXT.
 	};
 
+	static StringStream make_string_stream(char* buff, size_t buff_size, bool compact)
+	{
+		if (buff_size > 0) { buff[0] = '\0'; }
+		return StringStream{buff, buff_size, 0, compact};
+	}
+
+	static void stream_write(StringStream& out, const char* text, size_t length)
+	{
+		if (out.size + 1 < out.capacity) {
+			const size_t num_fit = std::min(length, out.capacity - 1 - out.size);
+			memcpy(out.buff + out.size, text, num_fit);
+			out.buff[out.size + num_fit] = '\0';
+		}
+		out.size += length;
+	}
+
+	static void stream_printf(StringStream& out, const char* format, ...) LOGURU_PRINTF_LIKE(2, 3);
+	static void stream_printf(StringStream& out, const char* format, ...)
+	{
+		// Straight into the room left, so long values (like 1e300) are never cut short when they fit.
+		const size_t room = out.size < out.capacity ? out.capacity - out.size : 0;
+		va_list vlist;
+		va_start(vlist, format);
+		const int length = vsnprintf(room > 0 ? out.buff + out.size : nullptr, room, format, vlist);
+		va_end(vlist);
+		if (length > 0) {
+			out.size += static_cast<size_t>(length);
+		}
+		else if (room > 0) {
+			out.buff[out.size] = '\0';
+		}
+	}
+
 	// Use this in your EcPrinter implementations.
 	void stream_print(StringStream& out_string_stream, const char* text)
 	{
-		out_string_stream.str += text;
+		stream_write(out_string_stream, text, strlen(text));
 	}
 
 	// ----------------------------------------------------------------------------
@@ -1447,15 +5245,6 @@ namespace loguru
 	using ECPtr = EcEntryBase*;
 
 #if defined(_WIN32) || (defined(__APPLE__) && !TARGET_OS_IPHONE)
-#ifdef __APPLE__
-#define LOGURU_THREAD_LOCAL __thread
-#else
-#if _MSC_VER > 1800
-#define LOGURU_THREAD_LOCAL thread_local
-#else
-#define LOGURU_THREAD_LOCAL __declspec(thread)
-#endif
-#endif
 	static LOGURU_THREAD_LOCAL ECPtr thread_ec_ptr = nullptr;
 
 	ECPtr& get_thread_ec_head_ref()
@@ -1500,29 +5289,99 @@ namespace loguru
 		return get_error_context_for(get_thread_ec_head_ref());
 	}
 
+	// The list starts with the innermost context, so recurse to print the outermost first.
+	static void stream_ec_entries(StringStream& out, const EcEntryBase* entry)
+	{
+		if (entry == nullptr) { return; }
+		stream_ec_entries(out, entry->_previous);
+
+		if (out.compact) {
+			if (entry->_previous) { stream_print(out, ", "); }
+			stream_print(out, entry->_descr);
+			stream_print(out, ": ");
+			entry->print_value(out);
+		} else {
+			stream_printf(out, "[ErrorContext] %23s:%-5u ", filename(entry->_file), entry->_line);
+			stream_print(out, entry->_descr);
+			stream_print(out, ":");
+			for (size_t width = strlen(entry->_descr) + 1; width < 20; ++width) {
+				stream_write(out, " ", 1);
+			}
+			stream_write(out, " ", 1);
+			entry->print_value(out);
+			stream_write(out, "\n", 1);
+		}
+	}
+
+	static void stream_error_context(StringStream& out, const EcEntryBase* ec_head)
+	{
+		if (ec_head == nullptr) { return; }
+		if (out.compact) {
+			stream_print(out, "{");
+			stream_ec_entries(out, ec_head);
+			stream_print(out, "}");
+		} else {
+			stream_print(out, "------------------------------------------------\n");
+			stream_ec_entries(out, ec_head);
+			stream_print(out, "------------------------------------------------");
+		}
+	}
+
+	size_t write_error_context(char* buff, size_t buff_size)
+	{
+		return write_error_context_for(get_thread_ec_head_ref(), buff, buff_size);
+	}
+
+	size_t write_error_context_for(const EcEntryBase* ec_head, char* buff, size_t buff_size)
+	{
+		StringStream out = make_string_stream(buff, buff_size, false);
+		stream_error_context(out, ec_head);
+		return out.size;
+	}
+
 	Text get_error_context_for(const EcEntryBase* ec_head)
 	{
-		std::vector<const EcEntryBase*> stack;
-		while (ec_head) {
-			stack.push_back(ec_head);
-			ec_head = ec_head->_previous;
+		char buff[1024];
+		const size_t length = write_error_context_for(ec_head, buff, sizeof(buff));
+		if (length < sizeof(buff)) {
+			return Text(_strdup(buff));
 		}
-		std::reverse(stack.begin(), stack.end());
+		char* text = static_cast<char*>(malloc(length + 1));
+		write_error_context_for(ec_head, text, length + 1);
+		return Text(text);
+	}
 
-		StringStream result;
-		if (!stack.empty()) {
-			result.str += "------------------------------------------------\n";
-			for (auto entry : stack) {
-				const auto description = std::string(entry->_descr) + ":";
-				auto prefix = textprintf("[ErrorContext] %23s:%-5u %-20s ",
-					filename(entry->_file), entry->_line, description.c_str());
-				result.str += prefix.c_str();
-				entry->print_value(result);
-				result.str += "\n";
-			}
-			result.str += "------------------------------------------------";
+	void log_with_context(Verbosity verbosity, const char* file, unsigned line, const char* format, ...)
+	{
+		if (!is_level_on(verbosity)) { return; }
+
+		va_list vlist;
+		va_start(vlist, format);
+		FormatBuffer buff(format, vlist);
+		va_end(vlist);
+
+		const EcEntryBase* ec_head = get_thread_ec_head_ref();
+		if (ec_head == nullptr) {
+			log_to_everywhere(1, verbosity, file, line, "", buff.c_str());
+			return;
+		}
+
+		auto write_text = [&](StringStream& out) {
+			stream_print(out, buff.c_str());
+			stream_write(out, " ", 1);
+			stream_error_context(out, ec_head);
+		};
+		char text[LOGURU_FORMAT_BUFFER_SIZE];
+		StringStream out = make_string_stream(text, sizeof(text), true);
+		write_text(out);
+		if (out.size < sizeof(text)) {
+			log_to_everywhere(1, verbosity, file, line, "", text);
+		} else {
+			std::vector<char> big(out.size + 1);
+			StringStream big_out = make_string_stream(big.data(), big.size(), true);
+			write_text(big_out);
+			log_to_everywhere(1, verbosity, file, line, "", big.data());
 		}
-		return Text(_strdup(result.str.c_str()));
 	}
 
 	EcEntryBase::EcEntryBase(const char* file, unsigned line, const char* descr)
@@ -1548,74 +5407,95 @@ namespace loguru
 		return Text{ _strdup(str.c_str()) };
 	}
 
-	Text ec_to_text(char c)
+	// The built-in types are written straight into the stream, unless EcEntryData was given a printer of its own.
+	template<typename T>
+	static bool ec_print_custom(StringStream& out, T value, Text (*printer)(T))
 	{
-		// Add quotes around the character to make it obvious where it begin and ends.
-		std::string str = "'";
+		if (!printer || printer == static_cast<Text (*)(T)>(ec_to_text)) { return false; }
+		stream_print(out, printer(value).c_str());
+		return true;
+	}
 
-		auto write_hex_digit = [&](unsigned num)
-		{
-			if (num < 10u) { str += char('0' + num); }
-			else { str += char('a' + num - 10); }
-		};
+	void ec_print(StringStream& out, const char* value, Text (*printer)(const char*))
+	{
+		if (ec_print_custom(out, value, printer)) { return; }
+		stream_write(out, "\"", 1);
+		stream_print(out, value);
+		stream_write(out, "\"", 1);
+	}
 
-		auto write_hex_16 = [&](uint16_t n)
+	void ec_print(StringStream& out, char c, Text (*printer)(char))
+	{
+		if (ec_print_custom(out, c, printer)) { return; }
+		// Add quotes around the character to make it obvious where it begin and ends.
+		switch (c)
 		{
-			write_hex_digit((n >> 12u) & 0x0f);
-			write_hex_digit((n >> 8u) & 0x0f);
-			write_hex_digit((n >> 4u) & 0x0f);
-			write_hex_digit((n >> 0u) & 0x0f);
-		};
-
-    switch (c)
-    {
-    case '\\': str += "\\\\"; break;
-    case '\"': str += "\\\""; break;
-    case '\'': str += "\\\'"; break;
-    case '\0': str += "\\0";  break;
-    case '\b': str += "\\b";  break;
-    case '\f': str += "\\f";  break;
-    case '\n': str += "\\n";  break;
-    case '\r': str += "\\r";  break;
-    case '\t': str += "\\t";  break;
-             case  1: case  2: case  3: case  4: case  5: case  6: case  7: 
-             case 11:                   case 14: case 15: case 16: case 17: case 18: case 19:
-    case 20: case 21: case 22: case 23: case 24: case 25: case 26: case 27: case 28: case 29:
-    case 30: case 31: { str += "\\u"; write_hex_16(static_cast<uint16_t>(c)); } break;
-    default:  str += c; break;
-    }
-
-		str += "'";
+		case '\\':  stream_print(out, "'\\\\'"); break;
+		case '\"':  stream_print(out, "'\\\"'");  break;
+		case '\'':  stream_print(out, "'\\\''");  break;
+		case '\0':  stream_print(out, "'\\0'");  break;
+		case '\b':  stream_print(out, "'\\b'");  break;
+		case '\f':  stream_print(out, "'\\f'");  break;
+		case '\n':  stream_print(out, "'\\n'");  break;
+		case '\r':  stream_print(out, "'\\r'");  break;
+		case '\t':  stream_print(out, "'\\t'");  break;
+		default:
+			if (c > 0 && c < 32) {
+				stream_printf(out, "'\\u%04x'", static_cast<unsigned>(c));
+			} else {
+				const char str[] = {'\'', c, '\'', '\0'};
+				stream_print(out, str);
+			}
+			break;
+		}
+	}
 
-		return Text{ _strdup(str.c_str()) };
+	Text ec_to_text(char c)
+	{
+		char buff[16];
+		StringStream out = make_string_stream(buff, sizeof(buff), false);
+		ec_print(out, c, nullptr);
+		return Text{ _strdup(buff) };
 	}
 
-#define DEFINE_EC(Type)                        \
-		Text ec_to_text(Type value)                \
-		{                                          \
-			auto str = std::to_string(value);      \
-			return Text{_strdup(str.c_str())};      \
+#define DEFINE_EC(Type, format)                                             \
+		Text ec_to_text(Type value)                                         \
+		{                                                                   \
+			return textprintf(format, value);                               \
+		}                                                                   \
+		void ec_print(StringStream& out, Type value, Text (*printer)(Type)) \
+		{                                                                   \
+			if (ec_print_custom(out, value, printer)) { return; }           \
+			stream_printf(out, format, value);                              \
 		}
 
-	DEFINE_EC(int)
-		DEFINE_EC(unsigned int)
-		DEFINE_EC(long)
-		DEFINE_EC(unsigned long)
-		DEFINE_EC(long long)
-		DEFINE_EC(unsigned long long)
-		DEFINE_EC(float)
-		DEFINE_EC(double)
-		DEFINE_EC(long double)
+	DEFINE_EC(int,                "%d")
+	DEFINE_EC(unsigned int,       "%u")
+	DEFINE_EC(long,               "%ld")
+	DEFINE_EC(unsigned long,      "%lu")
+	DEFINE_EC(long long,          "%lld")
+	DEFINE_EC(unsigned long long, "%llu")
+	DEFINE_EC(float,              "%f")
+	DEFINE_EC(double,             "%f")
+	DEFINE_EC(long double,        "%Lf")
 
 #undef DEFINE_EC
 
-		Text ec_to_text(EcHandle ec_handle)
+	// The error context of another thread (see get_thread_ec_handle), printed in place.
+	void ec_print(StringStream& out, const EcEntryBase* ec_handle, Text (*printer)(const EcEntryBase*))
+	{
+		if (ec_print_custom(out, ec_handle, printer)) { return; }
+		if (!out.compact) { stream_write(out, "\n", 1); }
+		stream_error_context(out, ec_handle);
+	}
+
+	Text ec_to_text(EcHandle ec_handle)
 	{
 		Text parent_ec = get_error_context_for(ec_handle);
-		char* with_newline = (char*)malloc(strlen(parent_ec.c_str()) + 2);
+		const size_t length = strlen(parent_ec.c_str());
+		char* with_newline = static_cast<char*>(malloc(length + 2));
 		with_newline[0] = '\n';
-		//strcpy(with_newline + 1, parent_ec.c_str());
-		strcpy_s(with_newline + 1, sizeof(with_newline), parent_ec.c_str());
+		memcpy(with_newline + 1, parent_ec.c_str(), length + 1);
 		return Text(with_newline);
 	}
 
@@ -1671,8 +5551,7 @@ namespace loguru
 
 	void write_to_stderr(const char* data, size_t size)
 	{
-		auto result = write(STDERR_FILENO, data, size);
-		(void)result; // Ignore errors.
+		write_fd(STDERR_FILENO, data, size);
 	}
 
 	void write_to_stderr(const char* data)
@@ -1721,31 +5600,73 @@ namespace loguru
 			write_to_stderr(terminal_reset());
 		}
 
+		// The crash report is safe too: the frames are only captured, not symbolized.
+#if LOGURU_STACKTRACES
+		void* frames[64];
+		const int num_frames = backtrace(frames, 64);
+#endif
+		const int crash_fd = s_crash_path[0] ? open(s_crash_path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+		if (crash_fd != -1) {
+			write_fd(crash_fd, "Loguru caught a signal: ");
+			write_fd(crash_fd, signal_name);
+			write_fd(crash_fd, "\n");
+#if LOGURU_STACKTRACES
+			write_fd(crash_fd, "Stack trace:\n");
+			backtrace_symbols_fd(frames, num_frames, crash_fd);
+#endif
+			write_async_records(crash_fd, s_crash_num_records);
+			close(crash_fd);
+		}
+		const int flight_fd = s_flight_path[0] && s_flight_scratch
+			? open(s_flight_path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+		if (flight_fd != -1) {
+			write_flight_recorder(s_flight_scratch, [flight_fd](const char* data, size_t size) {
+				write_fd(flight_fd, data, size);
+			});
+			close(flight_fd);
+		}
+
 		// --------------------------------------------------------------------
 
+		bool logged = false;
 #if LOGURU_UNSAFE_SIGNAL_HANDLER
 		// --------------------------------------------------------------------
 		/* Now we do unsafe things. This can for example lead to deadlocks if
 		the signal was triggered from the system's memory management functions
-		and the code below tries to do allocations.
+		and the code below tries to do allocations (it does: the message and the stack trace allocate).
+		We give up if another thread is in the middle of logging, since we would wait for it forever,
+		or if this one is: s_mutex is recursive, so we would get it and write over half-written state.
 		*/
 
-		flush();
-		char preamble_buff[128];
-		print_preamble(preamble_buff, sizeof(preamble_buff), Verbosity_FATAL, "", 0);
-		auto message = Message{ Verbosity_FATAL, "", 0, preamble_buff, "", "Signal: ", signal_name };
-		try {
-			log_message(1, message, false, false);
-		}
-		catch (...) {
-			// This can happed due to s_fatal_handler.
-			write_to_stderr("Exception caught and ignored by Loguru signal handler.\n");
+		if (!s_thread_is_writing && s_mutex.try_lock()) {
+			flush();
+			PreambleInfo preamble;
+			make_preamble_info(preamble, Verbosity_FATAL, "", 0);
+			auto message = Message{ Verbosity_FATAL, "", 0, "", "", "Signal: ", signal_name, nullptr, 0,
+				preamble.ms_since_epoch };
+			try {
+				log_message(1, preamble, message, false, false);
+			}
+			catch (...) {
+				// This can happed due to s_fatal_handler.
+				write_to_stderr("Exception caught and ignored by Loguru signal handler.\n");
+			}
+			flush();
+			s_mutex.unlock();
+			logged = true;
 		}
-		flush();
 
 		// --------------------------------------------------------------------
 #endif // LOGURU_UNSAFE_SIGNAL_HANDLER
 
+#if LOGURU_STACKTRACES
+		if (!logged) {
+			write_to_stderr("Stack trace:\n");
+			backtrace_symbols_fd(frames, num_frames, STDERR_FILENO);
+		}
+#endif
+		(void)logged;
+
 		call_default_signal_handler(signal_number);
 	}
 
@@ -1756,6 +5677,11 @@ namespace loguru
 		sigemptyset(&sig_action.sa_mask);
 		sig_action.sa_flags |= SA_SIGINFO;
 		sig_action.sa_sigaction = &signal_handler;
+#if LOGURU_STACKTRACES
+		// The first call to backtrace can allocate (it loads libgcc), so get that done now.
+		void* frame;
+		backtrace(&frame, 1);
+#endif
 		for (const auto& s : ALL_SIGNALS) {
 			CHECK_F(sigaction(s.number, &sig_action, NULL) != -1,
 				"Failed to install handler for %s", s.name);
@@ -79,6 +79,7 @@ Website: www.ilikebigbits.com
 	LOG_F(2, "Will only show if verbosity is 2 or higher");
 	VLOG_F(get_log_level(), "Use vlog for dynamic log level (integer in the range 0-9, inclusive)");
 	LOG_IF_F(ERROR, badness, "Will only show if badness happens");
+	LOG_EVERY_N_F(100, WARNING, "Will show on the 1st, 101st, 201st... call, with a count of the skipped ones");
 	auto fp = fopen(filename, "r");
 	CHECK_F(fp != nullptr, "Failed to open file '%s'", filename);
 	CHECK_GT_F(length, 0); // Will print the value of `length` on failure.
@@ -88,6 +89,9 @@ Website: www.ilikebigbits.com
 	DCHECK_F(expensive_check(x)); // Only checked #if !NDEBUG
 	DLOG_F("Only written in debug-builds");
 
+	// Write stderr and files from a background thread, so logging never waits on I/O:
+	loguru::start_async();
+
 	// Turn off writing to stderr:
 	loguru::g_stderr_verbosity = loguru::Verbosity_OFF;
 
@@ -112,6 +116,10 @@ Website: www.ilikebigbits.com
 	LOGURU_REDEFINE_ASSERT (default 0):
 		Redefine "assert" call Loguru version (!NDEBUG only).
 
+	LOGURU_WITH_ZSTD, LOGURU_WITH_LZ4 (default 0):
+		Add loguru::zstd_compressor() and loguru::lz4_compressor() for add_compressed_file.
+		Define them when compiling loguru.cpp too, and link with libzstd or liblz4.
+
 	LOGURU_WITH_STREAMS (default 0):
 		Add support for _S versions for all LOG and CHECK functions:
 			LOG_S(INFO) << "My vec3: " << x.cross(y);
@@ -127,12 +135,40 @@ Website: www.ilikebigbits.com
 		Make Loguru try to do unsafe but useful things,
 		like printing a stack trace, when catching signals.
 		This may lead to bad things like deadlocks in certain situations.
+		It is skipped if a thread (the crashing one included) is writing a message at the time;
+		then only the raw stack frames are printed. It still allocates, so a signal raised inside
+		malloc can deadlock it.
+		With 0, the raw frames are always printed. See also loguru::set_crash_file.
+
+	LOGURU_STACKTRACE_SYMBOLIZE (default 1):
+		Set to 0 to get stack traces with module and offset (e.g. "./app(+0x4f2a)") instead of function names.
+		That is cheaper, and they can be symbolized later with e.g. `addr2line -Cfe ./app 0x4f2a`.
+		Define it when compiling loguru.cpp.
+
+	LOGURU_COMPILE_TIME_MIN_VERBOSITY (default 9):
+		Remove log statements more verbose than this at compile time,
+		e.g. -DLOGURU_COMPILE_TIME_MIN_VERBOSITY=0 to drop all LOG_F(1..9) from a release build.
 
 	You can also configure:
 	loguru::g_flush_interval_ms:
 		If set to zero Loguru will flush on every line (unbuffered mode).
-		Else Loguru will flush outputs every g_flush_interval_ms milliseconds (buffered mode).
-		The default is g_flush_interval_ms=0, i.e. unbuffered mode.
+		Else Loguru will flush an output at most g_flush_interval_ms milliseconds after its first
+		unflushed line (buffered mode). A background thread does this; it sleeps while nothing is logged.
+		The default is g_flush_interval_ms=0, i.e. unbuffered mode. See also set_flush_interval.
+		In buffered mode, files from add_file are written with one syscall per LOGURU_FILE_BUFFER_SIZE bytes,
+		and whenever an ERROR or FATAL is logged.
+	loguru::g_dedup_window_ms:
+		If non-zero, a message that repeats the previous one (same file, line and text) within this many
+		milliseconds is dropped. The count is logged as "(repeated N more times)" before the next
+		different message, or at the next flush(). The window starts at the message that was written,
+		not the last repeat, so a message that keeps repeating is still written once per window.
+		The default is 0 (off).
+	loguru::g_preamble_thread_index:
+		If true, the preamble shows the number from get_thread_index() instead of the thread name.
+		The default is false.
+	loguru::g_time_outputs:
+		If true, the time spent in each output is measured for get_output_stats (total_ns and max_ns).
+		This costs a clock read per output and message, so the default is false.
 
 # Notes:
 	* Any arguments to CHECK:s are only evaluated once.
@@ -158,11 +194,56 @@ Website: www.ilikebigbits.com
 	#define LOGURU_SCOPE_TEXT_SIZE 196
 #endif
 
+#ifndef LOGURU_COMPILE_TIME_MIN_VERBOSITY
+	// Log statements more verbose than this are removed at compile time:
+	// their arguments are never evaluated, and their format strings never reach the binary.
+	// For instance, -DLOGURU_COMPILE_TIME_MIN_VERBOSITY=0 keeps FATAL, ERROR, WARNING and INFO.
+	// The default (Verbosity_MAX) keeps everything.
+	#define LOGURU_COMPILE_TIME_MIN_VERBOSITY 9
+#endif
+
+#ifndef LOGURU_FORMAT_BUFFER_SIZE
+	// LOG_F formats into a stack buffer of this size. Only longer messages need a heap allocation.
+	#define LOGURU_FORMAT_BUFFER_SIZE 1024
+#endif
+
+#ifndef LOGURU_FILE_BUFFER_SIZE
+	// Each add_file gathers lines in a buffer this big and writes them out with one syscall.
+	#define LOGURU_FILE_BUFFER_SIZE (64 * 1024)
+#endif
+
+#ifndef LOGURU_ASYNC_WAKE_MS
+	// In async mode, INFO and verbose messages wait at most this long for the writer thread (see start_async).
+	#define LOGURU_ASYNC_WAKE_MS 10
+#endif
+
+#ifndef LOGURU_NETWORK_BUFFER_SIZE
+	// Each add_network_sink keeps at most this many bytes of unsent lines. Beyond that the oldest are dropped.
+	#define LOGURU_NETWORK_BUFFER_SIZE (1024 * 1024)
+#endif
+
+#ifndef LOGURU_BINARY_ARGS_SIZE
+	// Maximum number of bytes of arguments that LOG_BIN_F can store. Longer strings are truncated.
+	#define LOGURU_BINARY_ARGS_SIZE 512
+#endif
+
+#ifndef LOGURU_WITH_ZSTD
+	#define LOGURU_WITH_ZSTD 0
+#endif
+
+#ifndef LOGURU_WITH_LZ4
+	#define LOGURU_WITH_LZ4 0
+#endif
+
 #ifndef LOGURU_CATCH_SIGABRT
 	// Should Loguru catch SIGABRT to print stack trace etc?
 	#define LOGURU_CATCH_SIGABRT 1
 #endif
 
+#ifndef LOGURU_STACKTRACE_SYMBOLIZE
+	#define LOGURU_STACKTRACE_SYMBOLIZE 1
+#endif
+
 #ifndef LOGURU_REDEFINE_ASSERT
 	#define LOGURU_REDEFINE_ASSERT 0
 #endif
@@ -219,6 +300,15 @@ Website: www.ilikebigbits.com
 //#define LOGURU_NORETURN [[noreturn]]
 #define LOGURU_NORETURN
 
+// For the failure paths of CHECK:s: kept out of line, and out of the way of the code that passes.
+#if defined(__clang__) || defined(__GNUC__)
+	#define LOGURU_COLD __attribute__((cold, noinline))
+#elif defined(_MSC_VER)
+	#define LOGURU_COLD __declspec(noinline)
+#else
+	#define LOGURU_COLD
+#endif
+
 #ifdef   _MSC_VER
 #include <iostream>
 #include <cctype>
@@ -231,6 +321,9 @@ Website: www.ilikebigbits.com
 #define LOGURU_PREDICT_TRUE(x)  (__builtin_expect(!!(x), 1))
 #endif
 
+#include <atomic>
+#include <cstddef>
+
 // --------------------------------------------------------------------
 
 namespace loguru
@@ -311,6 +404,23 @@ namespace loguru
 		Verbosity_MAX     = +9,
 	};
 
+	enum FieldType { Field_Int, Field_UInt, Field_Double, Field_Bool, Field_String };
+
+	// A typed key-value pair of a LOG_KV message. Strings are not copied, so they only live as long as the call.
+	struct Field
+	{
+		const char* key;
+		FieldType   type;
+		union
+		{
+			long long          i;
+			unsigned long long u;
+			double             d;
+			bool               b;
+			const char*        s;
+		} value;
+	};
+
 	struct Message
 	{
 		// You would generally print a Message by just concating the buffers without spacing.
@@ -318,10 +428,13 @@ namespace loguru
 		Verbosity   verbosity;   // Already part of preamble
 		const char* filename;    // Already part of preamble
 		unsigned    line;        // Already part of preamble
-		const char* preamble;    // Date, time, uptime, thread, file:line, verbosity.
+		const char* preamble;    // Date, time, uptime, thread, file:line, verbosity. See set_preamble_fields.
 		const char* indentation; // Just a bunch of spacing.
 		const char* prefix;      // Assertion failure info goes here (or "").
 		const char* message;     // User message goes here.
+		const Field* fields;     // LOG_KV only: "msg" followed by the key-value pairs. Already part of message.
+		size_t       num_fields;
+		long long    ms_since_epoch; // When it was logged (not when it is written, in async mode). Already part of preamble.
 	};
 
 	/* Everything with a verbosity equal or greater than g_stderr_verbosity will be
@@ -332,6 +445,9 @@ namespace loguru
 	extern Verbosity g_stderr_verbosity;
 	extern bool      g_colorlogtostderr; // True by default.
 	extern unsigned  g_flush_interval_ms; // 0 (unbuffered) by default.
+	extern unsigned  g_dedup_window_ms;   // 0 (off) by default.
+	extern bool      g_preamble_thread_index; // False by default: the preamble shows the thread name.
+	extern bool      g_time_outputs;      // False by default: OutputStats::total_ns and max_ns stay 0.
 
 	// May not throw!
 	typedef void (*log_handler_t)(void* user_data, const Message& message);
@@ -360,6 +476,7 @@ namespace loguru
 				-v ERROR    Only show ERROR, FATAL.
 				-v FATAL    Only show FATAL.
 				-v OFF      Turn off logging to stderr.
+			-vmodule spec   Per-file verbosity, e.g. -vmodule=net/*=3,db=1. See set_vmodule.
 
 		Tip: You can set g_stderr_verbosity before calling loguru::init.
 		That way you can set the default but have the user override it with the -v flag.
@@ -371,10 +488,11 @@ namespace loguru
 	void init(int& argc, char* argv[], const char* verbosity_flag = "-v");
 
 	// Will call remove_all_callbacks(). After calling this, logging will still go to stderr.
+	// From inside a callback or the fatal handler it only flushes (and prints an error).
 	void shutdown();
 
 	// What ~ will be replaced with, e.g. "/home/your_user_name/"
-	const char* home_dir();
+	bool home_dir(char (&result)[1024]);
 
 	/* Returns the name of the app as given in argv[0] but without leading path.
 	   That is, if argv[0] is "../foo/app" this will return "app".
@@ -405,6 +523,17 @@ namespace loguru
 
 	enum FileMode { Truncate, Append };
 
+	// What to do when logging faster than the async writer thread can keep up.
+	enum OverflowPolicy
+	{
+		Overflow_Block,       // Wait for room (the logging thread helps write the queue out).
+		Overflow_DropNewest,  // Throw away the message being logged.
+		Overflow_DropOldest,  // Throw away the oldest message in the queue.
+		Overflow_DropVerbose, // Throw away the message if it is above INFO, else block.
+	};
+
+	/*  Turn ERROR, WARNING or INFO messages (or the file name, with Verbosity_NAME) on or off.
+		Safe to call from any thread at any time. */
   void set_log(int err, bool onoff);
 
 	/*  Will log to a file at the given path.
@@ -416,19 +545,122 @@ namespace loguru
 	*/
 	bool add_file(const char* path, FileMode mode, Verbosity verbosity);
 
+	enum RotationInterval { Rotation_None, Rotation_Hourly, Rotation_Daily };
+
+	/*  When to start on a new file. The full file is renamed to path.1,
+		the previous path.1 to path.2 and so on, keeping max_files of them.
+		The rotation is done by a background thread, so a file can go a few lines past max_size.
+		Each new file starts with the same "arguments:" and "Current dir:" lines as the first one.
+		Example: loguru::add_file("app.log", loguru::Append, loguru::Verbosity_INFO,
+		                          loguru::FileRotation{ 100 * 1024 * 1024, loguru::Rotation_Daily, 7 }); */
+	struct FileRotation
+	{
+		size_t           max_size;  // Rotate before the file grows past this many bytes. 0 means no limit.
+		RotationInterval interval;  // Also rotate at the start of every hour or day (local time).
+		unsigned         max_files; // Number of rotated files to keep. 0 means just start over.
+	};
+
+	// Like add_file above, with rotation (instead of external tools like logrotate).
+	bool add_file(const char* path, FileMode mode, Verbosity verbosity, const FileRotation& rotation);
+
+	/*  Like add_file, but the file is memory-mapped (Linux only) in preallocated segments of segment_size bytes.
+		Each thread copies its lines straight into the mapping, without taking Loguru's lock,
+		so they survive in the page cache even if the process dies right after (e.g. in a signal handler).
+		Lines are written without scope indentation.
+		If the process dies, the file ends with the zero bytes of the preallocated segment.
+		Only one mapped file at a time. Stop it with loguru::remove_callback(path). */
+	bool add_mapped_file(const char* path, FileMode mode, Verbosity verbosity, size_t segment_size = 16 * 1024 * 1024);
+
+	// Compresses 'size' bytes into one self-contained frame of at most 'out_capacity' bytes. Returns its size, or 0 on error.
+	typedef size_t (*compress_handler_t)(void* user_data, const void* in, size_t size, void* out, size_t out_capacity);
+	// The largest frame that compressing 'size' bytes can produce.
+	typedef size_t (*compress_bound_handler_t)(void* user_data, size_t size);
+
+	struct Compressor
+	{
+		compress_handler_t       compress;
+		compress_bound_handler_t bound;
+		void*                    user_data;
+	};
+
+#if LOGURU_WITH_ZSTD
+	Compressor zstd_compressor(int level = 3);
+#endif
+#if LOGURU_WITH_LZ4
+	Compressor lz4_compressor();
+#endif
+
+	/*  Like add_file, but the lines are compressed: they are gathered until there are frame_size bytes
+		(or flush() is called, or the file is removed), then compressed into one frame and appended.
+		Frames are self-contained, so e.g. `zstd -dc` can decompress the file up to the last complete frame.
+		Compression runs on the writer thread in async mode (see start_async).
+		Set g_flush_interval_ms to bound how far behind the file can be.
+		Stop it with loguru::remove_callback(path). */
+	bool add_compressed_file(const char* path, FileMode mode, Verbosity verbosity,
+		const Compressor& compressor, size_t frame_size = 1024 * 1024);
+
+	enum StructuredFormat { Format_JsonLines, Format_Logfmt };
+
+	/*  Like add_file, but writes one JSON object (or logfmt line) per message, for log shippers:
+			{"time":"2016-05-26T13:02:07.123Z","level":"INFO","file":"main.cpp","line":42,"msg":"request done","user":42}
+		The LOG_KV fields keep their types. Other messages only have "msg".
+		The time is when the message was logged, as in the text preamble (also in async mode). */
+	bool add_structured_file(const char* path, FileMode mode, Verbosity verbosity, StructuredFormat format);
+
+	enum NetworkProtocol { Network_Udp, Network_Tcp };
+
+	/*  Sends the lines (as written to files) to a log collector, e.g. add_network_sink("logs.local", 5140, Network_Tcp, Verbosity_INFO).
+		The host is resolved once, here. The id is "udp://host:port" or "tcp://host:port", for remove_callback.
+		Lines are batched and sent by a background thread every 100 ms (see set_flush_interval),
+		or right away for ERROR and FATAL (and by flush()).
+		UDP sends whole lines in datagrams of about 1400 bytes. TCP reconnects with a backoff of up to 30 s.
+		Sending never blocks: while the collector is slow or down, at most LOGURU_NETWORK_BUFFER_SIZE bytes
+		are kept and the oldest lines are dropped (and counted in a line sent later). Not on Windows. */
+	bool add_network_sink(const char* host, unsigned port, NetworkProtocol protocol, Verbosity verbosity);
+
+	/*  Sends each message to the systemd journal (Linux only), with the native fields
+		MESSAGE, PRIORITY, CODE_FILE, CODE_LINE and SYSLOG_IDENTIFIER, plus the LOG_KV fields
+		(with upper-case keys, e.g. "user" becomes USER). The id is "journald".
+		Messages are dropped (and counted) if the journal is not keeping up. */
+	bool add_journald(Verbosity verbosity);
+
 	/*  Will be called right before abort().
 		You can for instance use this to print custom error messages, or throw an exception.
 		Feel free to call LOG:ing function from this, but not FATAL ones! */
 	void set_fatal_handler(fatal_handler_t handler);
 
+	/*  When a signal is caught, also write a crash report to this file (not on Windows): the signal,
+		the raw stack frames and the last num_records messages of the async queue (see start_async),
+		including the ones that never got to the outputs. It is written without locks or heap
+		allocations, so it gets out even if the crash happened inside malloc or while logging.
+		Pass nullptr to turn it off. */
+	void set_crash_file(const char* path, unsigned num_records = 64);
+
+	/*  Keeps the messages up to 'verbosity' (e.g. Verbosity_MAX) in memory only, like a flight recorder:
+		each thread appends its lines to its own ring buffer of bytes_per_thread bytes, without locks.
+		Messages that only the recorder wants go nowhere else (not even through the async queue).
+		What it holds is written to dump_path on FATAL and when a signal is caught, and by dump_flight_recorder.
+		Pass nullptr as dump_path to only dump on demand. The buffer of a thread that exits is reused by the next new one.
+		Only one flight recorder at a time. Stop it with loguru::remove_callback("flight_recorder"). */
+	bool add_flight_recorder(const char* dump_path, Verbosity verbosity, size_t bytes_per_thread = 64 * 1024);
+
+	// Writes what the flight recorder holds to 'path', one section per thread. Returns false if it is off, or on error.
+	bool dump_flight_recorder(const char* path);
+
 	/*  Will be called on each log messages with a verbosity less or equal to the given one.
 		Useful for displaying messages on-screen in a game, for example.
 		The given on_close is also expected to flush (if desired).
+		Callbacks are called one at a time with an internal mutex locked. Pass thread_safe = true
+		if yours can take concurrent calls: it is then called directly from the logging threads
+		(from the writer thread in async mode).
+		A callback may add callbacks, but remove_callback, remove_all_callbacks, stop_async and shutdown
+		fail with an error from within one (or the fatal handler), since they wait for the callbacks to return.
 	*/
 	void add_callback(const char* id, log_handler_t callback, void* user_data,
 					  Verbosity verbosity,
 					  close_handler_t on_close = nullptr,
-					  flush_handler_t on_flush = nullptr);
+					  flush_handler_t on_flush = nullptr,
+					  bool thread_safe = false);
 
 	// Returns true iff the callback was found (and removed).
 	bool remove_callback(const char* id);
@@ -436,16 +668,191 @@ namespace loguru
 	// Shut down all file logging and any other callback hooks installed.
 	void remove_all_callbacks();
 
+	/*  Flush the output with this id (a callback id or an add_file path) at most interval_ms after
+		its first unflushed line, instead of following g_flush_interval_ms. 0 flushes after every line.
+		Returns false if there is no such output. */
+	bool set_flush_interval(const char* id, unsigned interval_ms);
+
+	// The parts of the preamble ("2016-05-26 13:02:07.123 (   0.001s) [main thread]  main.cpp:42    I| ").
+	enum PreambleField : unsigned
+	{
+		Preamble_None      = 0,
+		Preamble_DateTime  = 1 << 0,
+		Preamble_Uptime    = 1 << 1,
+		Preamble_Thread    = 1 << 2,
+		Preamble_File      = 1 << 3, // file:line
+		Preamble_Verbosity = 1 << 4,
+		Preamble_All       = (1 << 5) - 1,
+	};
+
+	/*  Choose the parts of Message::preamble that the output with this id (a callback id or an add_file path)
+		gets, e.g. Preamble_None for a callback that does not look at it. The default is Preamble_All.
+		Each distinct preamble is only built if an output needs it, and only once per message.
+		Returns false if there is no such output. */
+	bool set_preamble_fields(const char* id, unsigned fields);
+
+	/*  Turn on asynchronous logging.
+		Each log call will then format its message, push it onto a bounded lock-free queue
+		and return right away. A dedicated writer thread pops the messages and writes them
+		to stderr and to all callbacks (including the files from add_file).
+		Messages from the same thread are always written in the order they were logged.
+		flush(), shutdown() and FATAL messages drain the queue before they return.
+		So that it works in batches, the writer thread is only woken when the queue is an eighth full
+		or a WARNING or worse is logged, and otherwise every LOGURU_ASYNC_WAKE_MS.
+		Outputs that flush after every line (g_flush_interval_ms=0) then flush once per batch.
+		The queue holds queue_size messages (rounded up to a power of two).
+		It is allocated on the first call and reused if you stop and start again.
+		What happens when the queue is full is decided by 'overflow', see OverflowPolicy.
+	*/
+	void start_async(unsigned queue_size = 4096, OverflowPolicy overflow = Overflow_Block);
+
+	// Drain the queue, stop the writer thread and go back to synchronous logging.
+	void stop_async();
+
+	/*  Total number of messages dropped because the async queue was full.
+		Whenever messages are dropped, the writer thread also logs a warning
+		saying how many, so there is no silent gap in the log. */
+	unsigned long long async_dropped_count();
+
+	// What Loguru itself costs, see get_stats. Times are in nanoseconds.
+	struct Stats
+	{
+		unsigned long long messages[Verbosity_MAX - Verbosity_FATAL + 1]; // Logged per verbosity, from FATAL (at index 0) to 9.
+		long long          format_ns;          // Formatting messages. Estimated from one in 64 per thread.
+		long long          lock_wait_ns;       // Waiting for another thread to finish writing.
+		long long          async_queue_ns;     // Total time that messages spent in the async queue.
+		long long          async_queue_max_ns;
+		long long          async_full_ns;      // Waiting for room in a full async queue (Overflow_Block).
+		unsigned long long async_dropped;      // See async_dropped_count.
+		unsigned long long sink_dropped;       // By add_network_sink and add_journald.
+	};
+
+	// The same for one output.
+	struct OutputStats
+	{
+		unsigned long long messages;
+		unsigned long long bytes;    // Of the lines, as written to files.
+		unsigned long long flushes;
+		long long          total_ns; // Spent in its log and flush handlers. Only measured with g_time_outputs.
+		long long          max_ns;   // The longest call. Only measured with g_time_outputs.
+	};
+
+	// The counters since the start of the program (or reset_stats).
+	Stats get_stats();
+
+	// Counters of the output with this id ("stderr", a callback id or an add_file path). Returns false if there is none.
+	bool get_output_stats(const char* id, OutputStats& stats);
+
+	void reset_stats();
+
+	/*  Log get_stats and the counters of each output at INFO every interval_ms (from the flusher thread),
+		while anything is logged. 0 (the default) turns it off. */
+	void set_stats_interval(unsigned interval_ms);
+
 	// Returns the maximum of g_stderr_verbosity and all file/custom outputs.
 	Verbosity current_verbosity_cutoff();
 
+	/*  glog-style per-file verbosity, e.g. "net/*=3,db=1":
+		files matching net/* log up to verbosity 3 and db.cpp up to 1, whatever -v and add_file say.
+		A pattern without a '/' is matched against the file name without extension,
+		otherwise against the end of the path (without extension). '*' and '?' are wildcards.
+		The first matching rule wins. Like in glog, the messages a rule lets through
+		go to every output that takes INFO.
+		Pass "" to remove all rules. Returns false (and changes nothing) if the spec is malformed. */
+	bool set_vmodule(const char* spec);
+
+	// Bumped by set_vmodule, so call sites know to look up their cutoff again.
+	extern std::atomic<unsigned> g_vmodule_generation;
+
+	// Slow path of site_verbosity_cutoff.
+	Verbosity resolve_site_verbosity_cutoff(std::atomic<unsigned>& site, const char* file);
+
+	/*  The verbosity cutoff of one call site. 'site' caches set_vmodule's verdict for 'file':
+		the g_vmodule_generation it is valid for in the high bits, and the cutoff + 128 (or 0 for no rule) in the low byte. */
+	inline Verbosity site_verbosity_cutoff(std::atomic<unsigned>& site, const char* file)
+	{
+		const unsigned cached = site.load(std::memory_order_relaxed);
+		if ((cached >> 8) != g_vmodule_generation.load(std::memory_order_relaxed)) {
+			return resolve_site_verbosity_cutoff(site, file);
+		}
+		if ((cached & 0xff) == 0) {
+			return current_verbosity_cutoff();
+		}
+		return static_cast<Verbosity>(static_cast<int>(cached & 0xff) - 128);
+	}
+
+	/*  Per-call-site state of LOG_EVERY_N_F, LOG_FIRST_N_F and LOG_EVERY_T_F.
+		Each test returns -1 if the message should be skipped, else how many were skipped since the last one. */
+	struct RateLimit
+	{
+		long long every_n(unsigned long long n)
+		{
+			if (count.fetch_add(1, std::memory_order_relaxed) % (n ? n : 1) != 0) {
+				suppressed.fetch_add(1, std::memory_order_relaxed);
+				return -1;
+			}
+			return static_cast<long long>(suppressed.exchange(0, std::memory_order_relaxed));
+		}
+
+		long long first_n(unsigned long long n)
+		{
+			if (count.load(std::memory_order_relaxed) >= n) { return -1; } // Don't keep counting forever.
+			return count.fetch_add(1, std::memory_order_relaxed) < n ? 0 : -1;
+		}
+
+		long long every_t(double seconds);
+
+		std::atomic<unsigned long long> count{0};
+		std::atomic<unsigned long long> suppressed{0};
+		std::atomic<long long>          next_ns{0}; // For every_t.
+	};
+
+	// Like log, but notes how many messages were skipped (if any). Used by LOG_EVERY_N_F and friends.
+	void log_rate_limited(long long num_suppressed, Verbosity verbosity, const char* file, unsigned line,
+		LOGURU_FORMAT_STRING_TYPE format, ...) LOGURU_PRINTF_LIKE(5, 6);
+
+	inline Field typed_field(const char* key, FieldType type) { Field field; field.key = key; field.type = type; return field; }
+	inline Field make_field(const char* key, int                value) { Field f = typed_field(key, Field_Int);    f.value.i = value; return f; }
+	inline Field make_field(const char* key, long               value) { Field f = typed_field(key, Field_Int);    f.value.i = value; return f; }
+	inline Field make_field(const char* key, long long          value) { Field f = typed_field(key, Field_Int);    f.value.i = value; return f; }
+	inline Field make_field(const char* key, unsigned           value) { Field f = typed_field(key, Field_UInt);   f.value.u = value; return f; }
+	inline Field make_field(const char* key, unsigned long      value) { Field f = typed_field(key, Field_UInt);   f.value.u = value; return f; }
+	inline Field make_field(const char* key, unsigned long long value) { Field f = typed_field(key, Field_UInt);   f.value.u = value; return f; }
+	inline Field make_field(const char* key, double             value) { Field f = typed_field(key, Field_Double); f.value.d = value; return f; }
+	inline Field make_field(const char* key, bool               value) { Field f = typed_field(key, Field_Bool);   f.value.b = value; return f; }
+	inline Field make_field(const char* key, const char*        value) { Field f = typed_field(key, Field_String); f.value.s = value ? value : "(null)"; return f; }
+
+	inline void make_fields(Field*) {}
+
+	template <typename T, typename... KeyValues>
+	inline void make_fields(Field* out, const char* key, const T& value, const KeyValues&... key_values)
+	{
+		*out = make_field(key, value);
+		make_fields(out + 1, key_values...);
+	}
+
+	// Use LOG_KV instead. fields[0] is the "msg".
+	void log_fields(Verbosity verbosity, const char* file, unsigned line, const Field* fields, size_t num_fields);
+
+	template <typename... KeyValues>
+	void log_kv(Verbosity verbosity, const char* file, unsigned line, const char* msg, const KeyValues&... key_values)
+	{
+		static_assert(sizeof...(KeyValues) % 2 == 0, "LOG_KV takes a message followed by key, value pairs");
+		Field fields[1 + sizeof...(KeyValues) / 2];
+		make_fields(fields, "msg", msg, key_values...);
+		log_fields(verbosity, file, line, fields, 1 + sizeof...(KeyValues) / 2);
+	}
+
 	// Actual logging function. Use the LOG macro instead of calling this directly.
 	void log(Verbosity verbosity, const char* file, unsigned line, LOGURU_FORMAT_STRING_TYPE format, ...) LOGURU_PRINTF_LIKE(4, 5);
 
+	// Like log, but with the error context of this thread appended. Use LOG_F_WITH_CONTEXT.
+	void log_with_context(Verbosity verbosity, const char* file, unsigned line, LOGURU_FORMAT_STRING_TYPE format, ...) LOGURU_PRINTF_LIKE(4, 5);
+
 	// Log without any preamble or indentation.
 	void raw_log(Verbosity verbosity, const char* file, unsigned line, LOGURU_FORMAT_STRING_TYPE format, ...) LOGURU_PRINTF_LIKE(4, 5);
 
-	// Helper class for LOG_SCOPE_F
+	// Helper class for LOG_SCOPE_F. The scope depth is kept per thread, so entering and leaving takes no lock.
 	class LogScopeRAII
 	{
 	public:
@@ -466,21 +873,128 @@ namespace loguru
 		Verbosity   _verbosity;
 		const char* _file; // Set to null if we are disabled due to verbosity
 		unsigned    _line;
-		bool        _indent_stderr; // Did we?
+		Verbosity   _out_verbosity; // After -vmodule. Decides which outputs are indented.
 		long long   _start_time_ns;
 		char        _name[LOGURU_SCOPE_TEXT_SIZE];
 	};
 
+	// The duration histogram of one LOG_SCOPE_TIMING call site.
+	struct ScopeTiming;
+
+	// Called once per call site by LOG_SCOPE_TIMING. The site lives until the program exits.
+	ScopeTiming* register_scope_timing(const char* name, const char* file, unsigned line);
+
+	// Helper class for LOG_SCOPE_TIMING: adds the lifetime of the object to the histogram (if any).
+	class ScopeTimer
+	{
+	public:
+		explicit ScopeTimer(ScopeTiming* site);
+		~ScopeTimer();
+
+	private:
+		ScopeTimer(const ScopeTimer&) = delete;
+		ScopeTimer& operator=(const ScopeTimer&) = delete;
+
+		ScopeTiming* _site;
+		long long    _start_time_ns;
+	};
+
+	/*  Logs one line per LOG_SCOPE_TIMING call site that has been timed, with the number of calls
+		and the median, 99th percentile and maximum duration. Percentiles are accurate to about 6%.
+		Call it on demand, or periodically from a timer of your own.
+		With reset = true, the sites start over from zero afterwards.
+	*/
+	void log_scope_timings(Verbosity verbosity = Verbosity_INFO, bool reset = false);
+
 	// Marked as 'noreturn' for the benefit of the static analyzer and optimizer.
 	// stack_trace_skip is the number of extrace stack frames to skip above log_and_abort.
-	LOGURU_NORETURN void log_and_abort(int stack_trace_skip, const char* expr, const char* file, unsigned line, LOGURU_FORMAT_STRING_TYPE format, ...) LOGURU_PRINTF_LIKE(5, 6);
-	LOGURU_NORETURN void log_and_abort(int stack_trace_skip, const char* expr, const char* file, unsigned line);
+	LOGURU_NORETURN LOGURU_COLD void log_and_abort(int stack_trace_skip, const char* expr, const char* file, unsigned line, LOGURU_FORMAT_STRING_TYPE format, ...) LOGURU_PRINTF_LIKE(5, 6);
+	LOGURU_NORETURN LOGURU_COLD void log_and_abort(int stack_trace_skip, const char* expr, const char* file, unsigned line);
 
 	// Flush output to stderr and files.
-	// If g_flush_interval_ms is set to non-zero, this will be called automatically this often.
+	// If g_flush_interval_ms is set to non-zero, outputs are flushed automatically that long after a write.
 	// If not set, you do not need to call this at al.
+	// In async mode this will first write out everything in the queue.
 	void flush();
 
+	// ------------------------------------------------------------------------
+	// Binary logging:
+
+	/*  LOG_BIN_F skips the formatting: it writes the raw arguments to a binary file, together
+		with a reference to the call site and its format string, and returns.
+		The formatting is done later, offline, by the loguru_decode tool:
+
+			loguru::open_binary_file("~/loguru/app.bin", loguru::Truncate, loguru::Verbosity_MAX);
+			LOG_BIN_F(3, "Took %.3f ms to handle request %d from '%s'", ms, id, user_name);
+
+			$ loguru_decode app.bin > app.log
+
+		The decoded lines have the same layout as the ones Loguru writes to files.
+		Arguments can be any integer or floating point type, pointers and C strings (which are copied).
+		LOG_BIN_F messages only go to the binary file, not to stderr or callbacks.
+		Only one binary file can be open at a time.
+	*/
+	bool open_binary_file(const char* path, FileMode mode, Verbosity verbosity);
+
+	// Flushes and closes the binary file, if any. Called by shutdown().
+	void close_binary_file();
+
+	// The verbosity of the open binary file, or Verbosity_OFF if there is none.
+	Verbosity binary_verbosity_cutoff();
+
+	// A LOG_BIN_F call site. It is written once to a binary file, then referred to by id.
+	struct BinarySite
+	{
+		const char* file;
+		unsigned    line;
+		const char* format;
+	};
+
+	// The encoded arguments of one LOG_BIN_F call.
+	struct BinaryArgs
+	{
+		unsigned size;
+		bool     full; // Set when an argument did not fit. No more are added after that.
+		char     data[LOGURU_BINARY_ARGS_SIZE];
+	};
+
+	void binary_append(BinaryArgs& args, int value);
+	void binary_append(BinaryArgs& args, unsigned int value);
+	void binary_append(BinaryArgs& args, long value);
+	void binary_append(BinaryArgs& args, unsigned long value);
+	void binary_append(BinaryArgs& args, long long value);
+	void binary_append(BinaryArgs& args, unsigned long long value);
+	void binary_append(BinaryArgs& args, double value);
+	void binary_append(BinaryArgs& args, long double value);
+	void binary_append(BinaryArgs& args, const char* value);
+	void binary_append(BinaryArgs& args, const void* value);
+
+	inline void binary_append_all(BinaryArgs&) {}
+
+	template<typename T, typename... Rest>
+	inline void binary_append_all(BinaryArgs& args, const T& first, const Rest&... rest)
+	{
+		binary_append(args, first);
+		binary_append_all(args, rest...);
+	}
+
+	void write_binary(const BinarySite& site, Verbosity verbosity, const BinaryArgs& args);
+
+	// Use the LOG_BIN_F macro instead of calling this directly.
+	template<typename... Args>
+	void log_binary(const BinarySite& site, Verbosity verbosity, const Args&... args)
+	{
+		BinaryArgs binary_args;
+		binary_args.size = 0;
+		binary_args.full = false;
+		binary_append_all(binary_args, args...);
+		write_binary(site, verbosity, binary_args);
+	}
+
+	// Never called. Lets the compiler check the arguments of LOG_BIN_F against the format string.
+	inline void check_binary_format(LOGURU_FORMAT_STRING_TYPE, ...) LOGURU_PRINTF_LIKE(1, 2);
+	inline void check_binary_format(LOGURU_FORMAT_STRING_TYPE, ...) {}
+
 	template<class T> inline Text format_value(const T&)                    { return textprintf("N/A");     }
 	template<>        inline Text format_value(const char& v)               { return textprintf("%c",   v); }
 	template<>        inline Text format_value(const int& v)                { return textprintf("%d",   v); }
@@ -492,6 +1006,17 @@ namespace loguru
 	template<>        inline Text format_value(const float& v)              { return textprintf("%f",   v); }
 	template<>        inline Text format_value(const double& v)             { return textprintf("%f",   v); }
 
+	// The "CHECK FAILED" text of a failed CHECK_OP_F. One instance per pair of operand types, out of line.
+	template<typename T1, typename T2>
+	LOGURU_COLD Text check_op_info(const char* expr_left, const char* op, const char* expr_right,
+		const T1& left, const T2& right)
+	{
+		auto str_left = format_value(left);
+		auto str_right = format_value(right);
+		return textprintf("CHECK FAILED:  %s %s %s  (%s %s %s)  ",
+			expr_left, op, expr_right, str_left.c_str(), op, str_right.c_str());
+	}
+
 	/* Thread names can be set for the benefit of readable logs.
 	   If you do not set the thread name, a hex id will be shown instead.
 	   These thread names may or may not be the same as the system thread names,
@@ -509,10 +1034,19 @@ namespace loguru
 	*/
 	void get_thread_name(char* buffer, unsigned long long length, bool right_align_hext_id);
 
+	/* Returns a small number for this thread: 1 for the first thread to call it (or to log), then 2, etc.
+	   It does not change with set_thread_name, and is never reused within the process.
+	   Set g_preamble_thread_index to show it in the preamble instead of the thread name.
+	   It is also the thread id in binary logs (LOG_BIN_F).
+	*/
+	unsigned get_thread_index();
+
 	/* Generates a readable stacktrace as a string.
 	   'skip' specifies how many stack frames to skip.
 	   For instance, the default skip (1) means:
-	   don't include the call to loguru::stacktrace in the stack trace. */
+	   don't include the call to loguru::stacktrace in the stack trace.
+	   Symbols are cached by address, so repeated traces through the same code are cheap.
+	   See also LOGURU_STACKTRACE_SYMBOLIZE. */
 	Text stacktrace(int skip = 1);
 
 	/*  Add a string to be replaced with something else in the stack output.
@@ -526,6 +1060,8 @@ namespace loguru
 			0x41f541 some_function(std::ofstream&)
 
 		`replace_with_this` must be shorter than `find_this`.
+		All cleanups are applied to each symbol in a single pass, so they do not apply to each other's output.
+		Where they overlap, the leftmost (then the longest) wins.
 	*/
 	void add_stack_cleanup(const char* find_this, const char* replace_with_this);
 
@@ -585,6 +1121,30 @@ namespace loguru
 	// Use this in your EcEntryBase::print_value overload.
 	void stream_print(StringStream& out_string_stream, const char* text);
 
+	class EcEntryBase;
+
+	// Prints the value of an ERROR_CONTEXT. Values of the built-in types are written straight
+	// into the stream, so rendering the error context does not allocate.
+	// Other types, and built-in ones given a printer other than ec_to_text, go through the printer.
+	template<typename T>
+	void ec_print(StringStream& out_string_stream, const T& value, Text (*printer)(T))
+	{
+		stream_print(out_string_stream, printer(value).c_str());
+	}
+
+	void ec_print(StringStream& out_string_stream, const char*        value, Text (*)(const char*));
+	void ec_print(StringStream& out_string_stream, char               value, Text (*)(char));
+	void ec_print(StringStream& out_string_stream, int                value, Text (*)(int));
+	void ec_print(StringStream& out_string_stream, unsigned int       value, Text (*)(unsigned int));
+	void ec_print(StringStream& out_string_stream, long               value, Text (*)(long));
+	void ec_print(StringStream& out_string_stream, unsigned long      value, Text (*)(unsigned long));
+	void ec_print(StringStream& out_string_stream, long long          value, Text (*)(long long));
+	void ec_print(StringStream& out_string_stream, unsigned long long value, Text (*)(unsigned long long));
+	void ec_print(StringStream& out_string_stream, float              value, Text (*)(float));
+	void ec_print(StringStream& out_string_stream, double             value, Text (*)(double));
+	void ec_print(StringStream& out_string_stream, long double        value, Text (*)(long double));
+	void ec_print(StringStream& out_string_stream, const EcEntryBase* value, Text (*)(const EcEntryBase*));
+
 	class EcEntryBase
 	{
 	public:
@@ -617,8 +1177,7 @@ namespace loguru
 
 		virtual void print_value(StringStream& out_string_stream) const override
 		{
-			const auto str = _printer(_data);
-			stream_print(out_string_stream, str.c_str());
+			ec_print(out_string_stream, _data, _printer);
 		}
 
 	private:
@@ -680,7 +1239,8 @@ namespace loguru
 		}
 
 		The context is in effect during the scope of the ERROR_CONTEXT.
-		Use loguru::get_error_context() to get the contents of the active error contexts.
+		Use loguru::get_error_context() to get the contents of the active error contexts,
+		or loguru::write_error_context(buff, size) to write them into a buffer without allocating.
 
 		Example result:
 
@@ -691,6 +1251,10 @@ namespace loguru
 
 		Error contexts are printed automatically on crashes, and only on crashes.
 		This makes them much faster than logging the value of a variable.
+		Use LOG_F_WITH_CONTEXT to add them to an ordinary log line on one line:
+
+		LOG_F_WITH_CONTEXT(ERROR, "Bad address");
+		=> Bad address {Processing file: "customers.json", Customer index: 42}
 	*/
 	#define ERROR_CONTEXT(descr, data)                                             \
 		const loguru::EcEntryData<loguru::make_ec_type<decltype(data)>::type>      \
@@ -736,6 +1300,11 @@ namespace loguru
 	// Get a string describing the error context of the given thread handle.
 	Text get_error_context_for(EcHandle ec_handle);
 
+	// Like get_error_context, but written into 'buff' without allocating. The text is cut short if it
+	// does not fit. Returns the length of the whole text (0 if there is no error context), like snprintf.
+	size_t write_error_context(char* buff, size_t buff_size);
+	size_t write_error_context_for(EcHandle ec_handle, char* buff, size_t buff_size);
+
 	// ------------------------------------------------------------------------
 
 	Text ec_to_text(const char* data);
@@ -790,40 +1359,137 @@ namespace loguru
 // --------------------------------------------------------------------
 // Logging macros
 
+// A compile-time constant for literal verbosities, so the optimizer removes the whole statement.
+#define LOGURU_IS_COMPILED_OUT(verbosity) ((verbosity) > LOGURU_COMPILE_TIME_MIN_VERBOSITY)
+
+// The verbosity cutoff for the current file (see loguru::set_vmodule), cached in a static per call site.
+#define LOGURU_SITE_VERBOSITY_CUTOFF()                                                             \
+	loguru::site_verbosity_cutoff([]() -> std::atomic<unsigned>& {                                 \
+		static std::atomic<unsigned> loguru_site{0};                                               \
+		return loguru_site;                                                                        \
+	}(), __FILE__)
+
 // LOG_F(2, "Only logged if verbosity is 2 or higher: %d", some_number);
 #define VLOG_F(verbosity, ...)                                                                     \
-	((verbosity) > loguru::current_verbosity_cutoff()) ? (void)0                                   \
-									  : loguru::log(verbosity, __FILE__, __LINE__, __VA_ARGS__)
+	(LOGURU_IS_COMPILED_OUT(verbosity) || (verbosity) > LOGURU_SITE_VERBOSITY_CUTOFF())            \
+		? (void)0                                                                                  \
+		: loguru::log(verbosity, __FILE__, __LINE__, __VA_ARGS__)
 
 // LOG_F(INFO, "Foo: %d", some_number);
 #define LOG_F(verbosity_name, ...) VLOG_F(loguru::Verbosity_ ## verbosity_name, __VA_ARGS__)
 
 #define VLOG_IF_F(verbosity, cond, ...)                                                            \
-	((verbosity) > loguru::current_verbosity_cutoff() || (cond) == false)                          \
+	(LOGURU_IS_COMPILED_OUT(verbosity) || (verbosity) > LOGURU_SITE_VERBOSITY_CUTOFF()             \
+		|| (cond) == false)                                                                        \
 		? (void)0                                                                                  \
 		: loguru::log(verbosity, __FILE__, __LINE__, __VA_ARGS__)
 
 #define LOG_IF_F(verbosity_name, cond, ...)                                                        \
 	VLOG_IF_F(loguru::Verbosity_ ## verbosity_name, cond, __VA_ARGS__)
 
+// LOG_F_WITH_CONTEXT(ERROR, "Bad address"); => Bad address {Customer index: 42}. See ERROR_CONTEXT.
+#define VLOG_F_WITH_CONTEXT(verbosity, ...)                                                        \
+	(LOGURU_IS_COMPILED_OUT(verbosity) || (verbosity) > LOGURU_SITE_VERBOSITY_CUTOFF())            \
+		? (void)0                                                                                  \
+		: loguru::log_with_context(verbosity, __FILE__, __LINE__, __VA_ARGS__)
+
+#define LOG_F_WITH_CONTEXT(verbosity_name, ...)                                                    \
+	VLOG_F_WITH_CONTEXT(loguru::Verbosity_ ## verbosity_name, __VA_ARGS__)
+
+/*  Structured logging. Values can be integers, floating point numbers, bools and C strings:
+		LOG_KV(INFO, "request done", "user", user_id, "latency_us", latency_us);
+	Text outputs get "request done user=42 latency_us=17". See add_structured_file. */
+#define VLOG_KV(verbosity, ...)                                                                    \
+	(LOGURU_IS_COMPILED_OUT(verbosity) || (verbosity) > LOGURU_SITE_VERBOSITY_CUTOFF())            \
+		? (void)0                                                                                  \
+		: loguru::log_kv(verbosity, __FILE__, __LINE__, __VA_ARGS__)
+
+#define LOG_KV(verbosity_name, ...) VLOG_KV(loguru::Verbosity_ ## verbosity_name, __VA_ARGS__)
+
+// -1 to skip the message, else the number skipped before it. 'test' is a member of loguru::RateLimit.
+#define LOGURU_RATE_LIMIT(verbosity, test, arg_type, arg)                                          \
+	((LOGURU_IS_COMPILED_OUT(verbosity) || (verbosity) > LOGURU_SITE_VERBOSITY_CUTOFF())           \
+		? -1LL                                                                                     \
+		: [](arg_type loguru_arg) -> long long {                                                   \
+			static loguru::RateLimit loguru_rate_limit;                                            \
+			return loguru_rate_limit.test(loguru_arg);                                             \
+		}(arg))
+
+#define LOGURU_RATE_LIMITED_F(verbosity, rate_limit, ...)                                          \
+	for (long long loguru_suppressed = rate_limit; loguru_suppressed >= 0; loguru_suppressed = -1) \
+		loguru::log_rate_limited(loguru_suppressed, verbosity, __FILE__, __LINE__, __VA_ARGS__)
+
+/*  Only the first of every n calls is logged, and only the first n calls, or at most one call per 'seconds'.
+	The arguments of the others are not evaluated. A logged message notes how many were skipped before it.
+		LOG_EVERY_N_F(1000, ERROR, "Failed to connect to %s", host);
+		LOG_EVERY_T_F(1.0, WARNING, "Queue is full");
+*/
+#define VLOG_EVERY_N_F(n, verbosity, ...)                                                          \
+	LOGURU_RATE_LIMITED_F(verbosity, LOGURU_RATE_LIMIT(verbosity, every_n, unsigned long long, n), __VA_ARGS__)
+#define VLOG_FIRST_N_F(n, verbosity, ...)                                                          \
+	LOGURU_RATE_LIMITED_F(verbosity, LOGURU_RATE_LIMIT(verbosity, first_n, unsigned long long, n), __VA_ARGS__)
+#define VLOG_EVERY_T_F(seconds, verbosity, ...)                                                    \
+	LOGURU_RATE_LIMITED_F(verbosity, LOGURU_RATE_LIMIT(verbosity, every_t, double, seconds), __VA_ARGS__)
+
+#define LOG_EVERY_N_F(n, verbosity_name, ...)                                                      \
+	VLOG_EVERY_N_F(n, loguru::Verbosity_ ## verbosity_name, __VA_ARGS__)
+#define LOG_FIRST_N_F(n, verbosity_name, ...)                                                      \
+	VLOG_FIRST_N_F(n, loguru::Verbosity_ ## verbosity_name, __VA_ARGS__)
+#define LOG_EVERY_T_F(seconds, verbosity_name, ...)                                                \
+	VLOG_EVERY_T_F(seconds, loguru::Verbosity_ ## verbosity_name, __VA_ARGS__)
+
 #define VLOG_SCOPE_F(verbosity, ...)                                                               \
 	loguru::LogScopeRAII LOGURU_ANONYMOUS_VARIABLE(error_context_RAII_) =                          \
-	((verbosity) > loguru::current_verbosity_cutoff()) ? loguru::LogScopeRAII() :                  \
+	(LOGURU_IS_COMPILED_OUT(verbosity) || (verbosity) > LOGURU_SITE_VERBOSITY_CUTOFF())            \
+		? loguru::LogScopeRAII() :                                                                 \
 	loguru::LogScopeRAII{verbosity, __FILE__, __LINE__, __VA_ARGS__}
 
 // Raw logging - no preamble, no indentation. Slightly faster than full logging.
 #define RAW_VLOG_F(verbosity, ...)                                                                 \
-	((verbosity) > loguru::current_verbosity_cutoff()) ? (void)0                                   \
-									  : loguru::raw_log(verbosity, __FILE__, __LINE__, __VA_ARGS__)
+	(LOGURU_IS_COMPILED_OUT(verbosity) || (verbosity) > LOGURU_SITE_VERBOSITY_CUTOFF())            \
+		? (void)0                                                                                  \
+		: loguru::raw_log(verbosity, __FILE__, __LINE__, __VA_ARGS__)
 
 #define RAW_LOG_F(verbosity_name, ...) RAW_VLOG_F(loguru::Verbosity_ ## verbosity_name, __VA_ARGS__)
 
-// Use to book-end a scope. Affects logging on all threads.
+// Binary logging - formatted offline by loguru_decode. See loguru::open_binary_file.
+#define VLOG_BIN_F(verbosity, format, ...)                                                         \
+	do                                                                                             \
+	{                                                                                              \
+		if (!LOGURU_IS_COMPILED_OUT(verbosity) && (verbosity) <= loguru::binary_verbosity_cutoff()) \
+		{                                                                                          \
+			static const loguru::BinarySite loguru_binary_site = { __FILE__, __LINE__, format };   \
+			if (false) { loguru::check_binary_format(format, ##__VA_ARGS__); }                     \
+			loguru::log_binary(loguru_binary_site, verbosity, ##__VA_ARGS__);                      \
+		}                                                                                          \
+	} while (false)
+
+#define LOG_BIN_F(verbosity_name, ...) VLOG_BIN_F(loguru::Verbosity_ ## verbosity_name, __VA_ARGS__)
+
+// Use to book-end a scope. Indents the messages of the calling thread.
 #define LOG_SCOPE_F(verbosity_name, ...)                                                           \
 	VLOG_SCOPE_F(loguru::Verbosity_ ## verbosity_name, __VA_ARGS__)
 
 #define LOG_SCOPE_FUNCTION(verbosity_name) LOG_SCOPE_F(verbosity_name, __PRETTY_FUNCTION__)
 
+// Like VLOG_SCOPE_F, but logs nothing: the duration goes into a histogram for the call site.
+// See loguru::log_scope_timings. 'name' is kept, so it should be a string literal.
+#define VLOG_SCOPE_TIMING(verbosity, name)                                                         \
+	loguru::ScopeTimer LOGURU_ANONYMOUS_VARIABLE(scope_timer_)(                                    \
+		(LOGURU_IS_COMPILED_OUT(verbosity) || (verbosity) > LOGURU_SITE_VERBOSITY_CUTOFF())        \
+			? nullptr                                                                              \
+			: [](const char* loguru_name) -> loguru::ScopeTiming* {                                \
+				static loguru::ScopeTiming* loguru_site =                                          \
+					loguru::register_scope_timing(loguru_name, __FILE__, __LINE__);                \
+				return loguru_site;                                                                \
+			}(name))
+
+// LOG_SCOPE_TIMING(INFO, "handle_request");
+#define LOG_SCOPE_TIMING(verbosity_name, name)                                                     \
+	VLOG_SCOPE_TIMING(loguru::Verbosity_ ## verbosity_name, name)
+
+#define LOG_SCOPE_FUNCTION_TIMING(verbosity_name) LOG_SCOPE_TIMING(verbosity_name, __PRETTY_FUNCTION__)
+
 // -----------------------------------------------
 // ABORT_F macro. Usage:  ABORT_F("Cause of error: %s", error_str);
 
@@ -851,13 +1517,8 @@ namespace loguru
 		auto val_right = expr_right;                                                               \
 		if (! LOGURU_PREDICT_TRUE(val_left op val_right))                                          \
 		{                                                                                          \
-			auto str_left = loguru::format_value(val_left);                                        \
-			auto str_right = loguru::format_value(val_right);                                      \
-			auto fail_info = loguru::textprintf("CHECK FAILED:  %s %s %s  (%s %s %s)  ",            \
-				#expr_left, #op, #expr_right, str_left.c_str(), #op, str_right.c_str());           \
-			auto user_msg = loguru::textprintf(__VA_ARGS__);                                        \
-			loguru::log_and_abort(0, fail_info.c_str(), __FILE__, __LINE__,                        \
-								  "%s", user_msg.c_str());                                         \
+			loguru::log_and_abort(0, loguru::check_op_info(#expr_left, #op, #expr_right,           \
+				val_left, val_right).c_str(), __FILE__, __LINE__, ##__VA_ARGS__);                  \
 		}                                                                                          \
 	} while (false)
 
@@ -941,10 +1602,15 @@ namespace loguru
 	// Like vsprintf, but returns the formated text.
 	std::string vstrprintf(LOGURU_FORMAT_STRING_TYPE format, va_list) LOGURU_PRINTF_LIKE(1, 0);
 
+	// StreamLogger and AbortLogger borrow a stream from a per-thread pool, so LOG_S does not allocate.
+	// The stream is given back (cleared) with release_log_stream.
+	std::ostream& acquire_log_stream();
+	void release_log_stream(std::ostream& stream);
+
 	class StreamLogger
 	{
 	public:
-		StreamLogger(Verbosity verbosity, const char* file, unsigned line) : _verbosity(verbosity), _file(file), _line(line) {}
+		StreamLogger(Verbosity verbosity, const char* file, unsigned line) : _verbosity(verbosity), _file(file), _line(line), _ss(acquire_log_stream()) {}
 		~StreamLogger() noexcept(false);
 
 		template<typename T>
@@ -965,14 +1631,14 @@ namespace loguru
 		Verbosity   _verbosity;
 		const char* _file;
 		unsigned    _line;
-		std::ostringstream _ss;
+		std::ostream& _ss;
 	};
 
 	class AbortLogger
 	{
 	public:
-		AbortLogger(const char* expr, const char* file, unsigned line) : _expr(expr), _file(file), _line(line) { }
-		LOGURU_NORETURN ~AbortLogger() noexcept(false);
+		AbortLogger(const char* expr, const char* file, unsigned line) : _expr(expr), _file(file), _line(line), _ss(acquire_log_stream()) { }
+		LOGURU_NORETURN LOGURU_COLD ~AbortLogger() noexcept(false);
 
 		template<typename T>
 		AbortLogger& operator<<(const T& t)
@@ -992,7 +1658,7 @@ namespace loguru
 		const char*        _expr;
 		const char*        _file;
 		unsigned           _line;
-		std::ostringstream _ss;
+		std::ostream&      _ss;
 	};
 
 	class Voidify
@@ -1006,15 +1672,22 @@ namespace loguru
 
 	/*  Helper functions for CHECK_OP_S macro.
 		GLOG trick: The (int, int) specialization works around the issue that the compiler
-		will not instantiate the template version of the function on values of unnamed enum type. */
+		will not instantiate the template version of the function on values of unnamed enum type.
+		The ostringstream is only in the out-of-line failure path, check_op_string. */
+	template <typename T1, typename T2>
+	LOGURU_COLD std::string* check_op_string(const char* expr, const T1& v1, const char* op_str, const T2& v2)
+	{
+		std::ostringstream ss;
+		ss << "CHECK FAILED:  " << expr << "  (" << v1 << " " << op_str << " " << v2 << ")  ";
+		return new std::string(ss.str());
+	}
+
 	#define DEFINE_CHECK_OP_IMPL(name, op)                                                             \
 		template <typename T1, typename T2>                                                            \
 		inline std::string* name(const char* expr, const T1& v1, const char* op_str, const T2& v2)     \
 		{                                                                                              \
 			if (LOGURU_PREDICT_TRUE(v1 op v2)) { return NULL; }                                        \
-			std::ostringstream ss;                                                                     \
-			ss << "CHECK FAILED:  " << expr << "  (" << v1 << " " << op_str << " " << v2 << ")  ";     \
-			return new std::string(ss.str());                                                          \
+			return check_op_string(expr, v1, op_str, v2);                                              \
 		}                                                                                              \
 		inline std::string* name(const char* expr, int v1, const char* op_str, int v2)                 \
 		{                                                                                              \
@@ -1044,6 +1717,14 @@ namespace loguru
 	inline unsigned long      referenceable_value(unsigned long      t) { return t; }
 	inline long long          referenceable_value(long long          t) { return t; }
 	inline unsigned long long referenceable_value(unsigned long long t) { return t; }
+
+	// Streams "(N suppressed) " in front of a rate-limited message, if N > 0.
+	struct SuppressedCount { long long count; };
+	inline std::ostream& operator<<(std::ostream& os, SuppressedCount suppressed)
+	{
+		if (suppressed.count > 0) { os << "(" << suppressed.count << " suppressed) "; }
+		return os;
+	}
 } // namespace loguru
 
 // -----------------------------------------------
@@ -1051,13 +1732,29 @@ namespace loguru
 
 // usage:  LOG_STREAM(INFO) << "Foo " << std::setprecision(10) << some_value;
 #define VLOG_IF_S(verbosity, cond)                                                                 \
-	((verbosity) > loguru::current_verbosity_cutoff() || (cond) == false)                          \
+	(LOGURU_IS_COMPILED_OUT(verbosity) || (verbosity) > LOGURU_SITE_VERBOSITY_CUTOFF()             \
+		|| (cond) == false)                                                                        \
 		? (void)0                                                                                  \
 		: loguru::Voidify() & loguru::StreamLogger(verbosity, __FILE__, __LINE__)
 #define LOG_IF_S(verbosity_name, cond) VLOG_IF_S(loguru::Verbosity_ ## verbosity_name, cond)
 #define VLOG_S(verbosity)              VLOG_IF_S(verbosity, true)
 #define LOG_S(verbosity_name)          VLOG_S(loguru::Verbosity_ ## verbosity_name)
 
+#define LOGURU_RATE_LIMITED_S(verbosity, rate_limit)                                               \
+	for (long long loguru_suppressed = rate_limit; loguru_suppressed >= 0; loguru_suppressed = -1) \
+		loguru::StreamLogger(verbosity, __FILE__, __LINE__) << loguru::SuppressedCount{loguru_suppressed}
+
+// LOG_EVERY_N_S(1000, ERROR) << "Failed to connect to " << host;
+#define VLOG_EVERY_N_S(n, verbosity)                                                               \
+	LOGURU_RATE_LIMITED_S(verbosity, LOGURU_RATE_LIMIT(verbosity, every_n, unsigned long long, n))
+#define VLOG_FIRST_N_S(n, verbosity)                                                               \
+	LOGURU_RATE_LIMITED_S(verbosity, LOGURU_RATE_LIMIT(verbosity, first_n, unsigned long long, n))
+#define VLOG_EVERY_T_S(seconds, verbosity)                                                         \
+	LOGURU_RATE_LIMITED_S(verbosity, LOGURU_RATE_LIMIT(verbosity, every_t, double, seconds))
+#define LOG_EVERY_N_S(n, verbosity_name)       VLOG_EVERY_N_S(n, loguru::Verbosity_ ## verbosity_name)
+#define LOG_FIRST_N_S(n, verbosity_name)       VLOG_FIRST_N_S(n, loguru::Verbosity_ ## verbosity_name)
+#define LOG_EVERY_T_S(seconds, verbosity_name) VLOG_EVERY_T_S(seconds, loguru::Verbosity_ ## verbosity_name)
+
 // -----------------------------------------------
 // ABORT_S macro. Usage:  ABORT_S() << "Causo of error: " << details;
 
@@ -1172,7 +1869,7 @@ namespace loguru
 	#define DCHECK_LE      DCHECK_LE_S
 	#define DCHECK_GT      DCHECK_GT_S
 	#define DCHECK_GE      DCHECK_GE_S
-	#define VLOG_IS_ON(verbosity) ((verbosity) <= loguru::current_verbosity_cutoff())
+	#define VLOG_IS_ON(verbosity) (!LOGURU_IS_COMPILED_OUT(verbosity) && (verbosity) <= LOGURU_SITE_VERBOSITY_CUTOFF())
 
 #endif // LOGURU_REPLACE_GLOG
 
@@ -0,0 +1,254 @@
+﻿/*
+loguru_bench: measures the cost of the logging hot paths.
+
+	Usage: loguru_bench [iterations]
+
+For each case it prints the time per call and the number of heap allocations per call.
+stderr is redirected to the null device while measuring, so the results go to stdout.
+The thread contention cases send the same total number of messages through each sink
+from 1 to 64 threads: ns/msg is wall time divided by the number of messages.
+Build with CMAKE_BUILD_TYPE=Release for meaningful numbers.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "loguru.h"
+
+// ----------------------------------------------------------------------------
+// Counting heap allocations.
+
+static std::atomic<unsigned long long> s_num_allocations{0};
+
+#if defined(__GLIBC__)
+// Count malloc itself, so that C allocations (vasprintf, strdup) are seen too.
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+
+extern "C" void* malloc(size_t size)
+{
+	s_num_allocations.fetch_add(1, std::memory_order_relaxed);
+	return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size)
+{
+	s_num_allocations.fetch_add(1, std::memory_order_relaxed);
+	return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size)
+{
+	s_num_allocations.fetch_add(1, std::memory_order_relaxed);
+	return __libc_realloc(ptr, size);
+}
+#else
+// Elsewhere only operator new is seen.
+void* operator new(size_t size)
+{
+	s_num_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* ptr = malloc(size ? size : 1)) { return ptr; }
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+	free(ptr);
+}
+#endif
+
+// ----------------------------------------------------------------------------
+
+namespace loguru_bench
+{
+	using Clock = std::chrono::steady_clock;
+
+#ifdef _WIN32
+	const char* NULL_DEVICE = "NUL";
+#else
+	const char* NULL_DEVICE = "/dev/null";
+#endif
+	const char* LOG_FILE = "loguru_bench.log";
+
+	volatile int s_sink; // Keeps the optimizer from removing the benchmarked expressions.
+
+	static double ns_since(Clock::time_point start)
+	{
+		return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+	}
+
+	static void print_row(const char* name, const char* extra, double ns, unsigned long long allocs, unsigned long long ops)
+	{
+		printf("%-36s %8s %10.1f %10.2f\n", name, extra, ns / ops, static_cast<double>(allocs) / ops);
+		fflush(stdout);
+	}
+
+	template <typename Body>
+	static void run(const char* name, unsigned long long iterations, Body body)
+	{
+		body(0); // Warm up the per-thread and per-site caches.
+		const auto allocs_before = s_num_allocations.load();
+		const auto start = Clock::now();
+		for (unsigned long long i = 0; i < iterations; ++i) {
+			body(static_cast<int>(i));
+		}
+		const double ns = ns_since(start);
+		print_row(name, "", ns, s_num_allocations.load() - allocs_before, iterations);
+	}
+
+	static void reset_outputs()
+	{
+		loguru::flush();
+		loguru::remove_all_callbacks();
+		loguru::g_stderr_verbosity = loguru::Verbosity_OFF;
+	}
+
+	static void null_callback(void*, const loguru::Message& message)
+	{
+		s_sink = static_cast<int>(message.verbosity);
+	}
+
+	static void single_thread(unsigned long long iterations)
+	{
+		printf("%-36s %8s %10s %10s\n", "case", "", "ns/op", "allocs/op");
+
+		reset_outputs();
+		loguru::add_file(NULL_DEVICE, loguru::Truncate, loguru::Verbosity_INFO);
+
+		run("VLOG_F(1) disabled", iterations, [](int i) {
+			VLOG_F(1, "Hello %d %s", i, "world");
+		});
+		run("LOG_F(INFO) to null file", iterations, [](int i) {
+			LOG_F(INFO, "Hello %d %s", i, "world");
+		});
+#if LOGURU_WITH_STREAMS
+		run("LOG_S(INFO) to null file", iterations, [](int i) {
+			LOG_S(INFO) << "Hello " << i << " world";
+		});
+#endif
+		run("LOG_SCOPE_F(INFO) to null file", iterations, [](int i) {
+			LOG_SCOPE_F(INFO, "Scope %d", i);
+		});
+		run("RAW_LOG_F(INFO) to null file", iterations, [](int i) {
+			RAW_LOG_F(INFO, "Hello %d %s", i, "world");
+		});
+		run("CHECK_F success", iterations, [](int i) {
+			CHECK_F(i >= 0, "Negative: %d", i);
+		});
+		run("CHECK_EQ_F success", iterations, [](int i) {
+			CHECK_EQ_F(i, s_sink * 0 + i);
+		});
+		run("CHECK_NOTNULL_F success", iterations, [](int i) {
+			CHECK_NOTNULL_F(&s_sink + (i & 1) * 0);
+		});
+		run("4 bounds checks (CHECK_LT_F etc)", iterations, [](int i) {
+			static int values[64];
+			const int index = i & 63;
+			CHECK_LT_F(index, 64);
+			CHECK_GE_F(values[index], 0);
+			CHECK_LE_F(values[index], 1000, "Bad value at %d", index);
+			CHECK_NE_F(values[index], 7);
+			s_sink = values[index];
+		});
+#if LOGURU_WITH_STREAMS
+		run("CHECK_EQ_S success", iterations, [](int i) {
+			CHECK_EQ_S(i, s_sink * 0 + i) << "Mismatch";
+		});
+#endif
+
+		loguru::start_async();
+		run("LOG_F(INFO) to null file, async", iterations, [](int i) {
+			LOG_F(INFO, "Hello %d %s", i, "world");
+		});
+		loguru::stop_async();
+
+		loguru::add_flight_recorder(nullptr, loguru::Verbosity_MAX);
+		run("VLOG_F(9) to flight recorder", iterations, [](int i) {
+			VLOG_F(9, "Hello %d %s", i, "world");
+		});
+
+		reset_outputs();
+	}
+
+	static void contention(const char* sink, unsigned num_threads, unsigned long long num_messages)
+	{
+		const unsigned long long per_thread = num_messages / num_threads;
+		std::atomic<unsigned> num_ready{0};
+		std::atomic<bool> go{false};
+		std::vector<std::thread> threads;
+		for (unsigned t = 0; t < num_threads; ++t) {
+			threads.emplace_back([&]() {
+				LOG_F(INFO, "Warm up");
+				num_ready.fetch_add(1);
+				while (!go.load()) { std::this_thread::yield(); }
+				for (unsigned long long i = 0; i < per_thread; ++i) {
+					LOG_F(INFO, "Hello %d %s", static_cast<int>(i), "world");
+				}
+			});
+		}
+		while (num_ready.load() < num_threads) { std::this_thread::yield(); }
+
+		const auto allocs_before = s_num_allocations.load();
+		const auto start = Clock::now();
+		go.store(true);
+		for (auto& thread : threads) {
+			thread.join();
+		}
+		loguru::flush();
+		const double ns = ns_since(start);
+
+		char threads_text[16];
+		snprintf(threads_text, sizeof(threads_text), "%u", num_threads);
+		print_row(sink, threads_text, ns, s_num_allocations.load() - allocs_before, per_thread * num_threads);
+	}
+
+	static void multi_thread(unsigned long long num_messages)
+	{
+		printf("\n%-36s %8s %10s %10s\n", "sink", "threads", "ns/msg", "allocs/msg");
+
+		const struct {
+			const char* name;
+			void (*add)();
+		} sinks[] = {
+			{ "stderr", [] { loguru::g_stderr_verbosity = loguru::Verbosity_INFO; } },
+			{ "file", [] { loguru::add_file(LOG_FILE, loguru::Truncate, loguru::Verbosity_INFO); } },
+			{ "callback", [] { loguru::add_callback("bench", null_callback, nullptr, loguru::Verbosity_INFO); } },
+			{ "callback, thread_safe", [] {
+				loguru::add_callback("bench", null_callback, nullptr, loguru::Verbosity_INFO, nullptr, nullptr, true);
+			} },
+		};
+
+		for (const auto& sink : sinks) {
+			for (unsigned num_threads = 1; num_threads <= 64; num_threads *= 2) {
+				sink.add();
+				contention(sink.name, num_threads, num_messages);
+				reset_outputs();
+			}
+		}
+		remove(LOG_FILE);
+	}
+} // namespace loguru_bench
+
+int main(int argc, char* argv[])
+{
+	unsigned long long iterations = 200000;
+	if (argc > 2 || (argc == 2 && (iterations = strtoull(argv[1], nullptr, 10)) == 0)) {
+		fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	if (!freopen(loguru_bench::NULL_DEVICE, "w", stderr)) {
+		printf("Failed to redirect stderr to %s\n", loguru_bench::NULL_DEVICE);
+		return 1;
+	}
+	printf("loguru_bench: %llu iterations\n\n", iterations);
+	loguru_bench::single_thread(iterations);
+	loguru_bench::multi_thread(iterations);
+	return 0;
+}
@@ -0,0 +1,47 @@
+﻿/*
+loguru_check_size: code size of the CHECK_* success path.
+
+	Build the check_size target, or compile this file with -O2 and run: nm -S -C loguru_check_size.o
+
+Each checked_* function does the same lookups as unchecked_lookups, with NUM_CHECKS checks in front.
+(size of checked_* - size of unchecked_lookups) / NUM_CHECKS is the inline cost of one check.
+The failure paths are out of line (in .text.unlikely with GCC), so they do not count.
+*/
+
+#include "loguru.h"
+
+#define NUM_CHECKS 8
+
+extern "C" int unchecked_lookups(const int* values, int count, int a, int b, int c, int d)
+{
+	(void)count;
+	return values[a] + values[b] + values[c] + values[d];
+}
+
+extern "C" int checked_lookups_f(const int* values, int count, int a, int b, int c, int d)
+{
+	CHECK_GE_F(a, 0);
+	CHECK_LT_F(a, count);
+	CHECK_GE_F(b, 0);
+	CHECK_LT_F(b, count, "Bad index %d", b);
+	CHECK_GE_F(c, 0);
+	CHECK_LT_F(c, count);
+	CHECK_GE_F(d, 0);
+	CHECK_LT_F(d, count, "Bad index %d", d);
+	return values[a] + values[b] + values[c] + values[d];
+}
+
+#if LOGURU_WITH_STREAMS
+extern "C" int checked_lookups_s(const int* values, int count, int a, int b, int c, int d)
+{
+	CHECK_GE_S(a, 0);
+	CHECK_LT_S(a, count);
+	CHECK_GE_S(b, 0);
+	CHECK_LT_S(b, count) << "Bad index " << b;
+	CHECK_GE_S(c, 0);
+	CHECK_LT_S(c, count);
+	CHECK_GE_S(d, 0);
+	CHECK_LT_S(d, count) << "Bad index " << d;
+	return values[a] + values[b] + values[c] + values[d];
+}
+#endif
@@ -0,0 +1,331 @@
+﻿/*
+loguru_decode: turns a binary log written by LOG_BIN_F into text.
+
+	Usage: loguru_decode input.bin [output.log]
+
+The output has the same layout as the lines Loguru writes to files.
+See the comment about the file layout in loguru.cpp (Binary logging).
+*/
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace loguru_decode
+{
+	const char BINARY_MAGIC[] = "LOGURUB1";
+	const int  THREAD_NAME_WIDTH = 2; // Same as in loguru.cpp.
+
+	struct Site
+	{
+		unsigned    line;
+		std::string file;
+		std::string format;
+	};
+
+	// Reads from the start of a byte range, refusing to read past its end.
+	class Reader
+	{
+	public:
+		Reader(const char* begin, const char* end) : _pos(begin), _end(end) {}
+
+		bool empty() const { return _pos >= _end; }
+
+		template<typename T>
+		bool read(T& out)
+		{
+			if (_end - _pos < static_cast<ptrdiff_t>(sizeof(T))) { return false; }
+			memcpy(&out, _pos, sizeof(T));
+			_pos += sizeof(T);
+			return true;
+		}
+
+		bool read_string(std::string& out)
+		{
+			uint16_t length;
+			if (!read(length) || _end - _pos < length) { return false; }
+			out.assign(_pos, length);
+			_pos += length;
+			return true;
+		}
+
+		bool read_bytes(size_t size, Reader& out)
+		{
+			if (_end - _pos < static_cast<ptrdiff_t>(size)) { return false; }
+			out = Reader(_pos, _pos + size);
+			_pos += size;
+			return true;
+		}
+
+	private:
+		const char* _pos;
+		const char* _end;
+	};
+
+	// One LOG_BIN_F argument.
+	struct Arg
+	{
+		char        type; // 'i', 'l', 'd', 'p' or 's'. 0 if missing.
+		int64_t     integer;
+		double      real;
+		std::string str;
+	};
+
+	static bool read_arg(Reader& in, Arg& arg)
+	{
+		arg.type = 0;
+		char type;
+		if (!in.read(type)) { return false; }
+		arg.type = type;
+		switch (type) {
+			case 'i': { int32_t value; if (!in.read(value)) { return false; } arg.integer = value; return true; }
+			case 'l': { int64_t value; if (!in.read(value)) { return false; } arg.integer = value; return true; }
+			case 'p': { uint64_t value; if (!in.read(value)) { return false; } arg.integer = static_cast<int64_t>(value); return true; }
+			case 'd': return in.read(arg.real);
+			case 's': return in.read_string(arg.str);
+			default:  arg.type = 0; return false;
+		}
+	}
+
+	static void append_formatted(std::string& out, const char* spec, ...)
+	{
+		char buff[512];
+		va_list vlist;
+		va_start(vlist, spec);
+		va_list vlist_copy;
+		va_copy(vlist_copy, vlist);
+		const int length = vsnprintf(buff, sizeof(buff), spec, vlist);
+		if (length >= static_cast<int>(sizeof(buff))) {
+			std::vector<char> big(static_cast<size_t>(length) + 1);
+			vsnprintf(big.data(), big.size(), spec, vlist_copy);
+			out.append(big.data(), static_cast<size_t>(length));
+		}
+		else if (length > 0) {
+			out.append(buff, static_cast<size_t>(length));
+		}
+		va_end(vlist_copy);
+		va_end(vlist);
+	}
+
+	// Formats one conversion ('spec' is e.g. "%-8.3", without length modifier or conversion).
+	static void format_arg(std::string& out, std::string spec, char conversion, const Arg& arg)
+	{
+		if (strchr("diouxXc", conversion)) {
+			if (arg.type == 'i') {
+				spec += conversion;
+				if (strchr("di", conversion) || conversion == 'c') {
+					append_formatted(out, spec.c_str(), static_cast<int>(arg.integer));
+				}
+				else {
+					append_formatted(out, spec.c_str(), static_cast<unsigned>(arg.integer));
+				}
+				return;
+			}
+			if (arg.type == 'l') {
+				spec += "ll";
+				spec += conversion;
+				append_formatted(out, spec.c_str(), static_cast<long long>(arg.integer));
+				return;
+			}
+		}
+		else if (strchr("eEfFgGaA", conversion) && arg.type == 'd') {
+			spec += conversion;
+			append_formatted(out, spec.c_str(), arg.real);
+			return;
+		}
+		else if (conversion == 's' && arg.type == 's') {
+			spec += 's';
+			append_formatted(out, spec.c_str(), arg.str.c_str());
+			return;
+		}
+		else if (conversion == 'p' && arg.type == 'p') {
+			spec += 'p';
+			append_formatted(out, spec.c_str(), reinterpret_cast<void*>(static_cast<uintptr_t>(arg.integer)));
+			return;
+		}
+		out += "<?>"; // Missing (truncated) or mismatching argument.
+	}
+
+	// Like snprintf, but with the arguments from a 'M' record.
+	static std::string format_message(const std::string& format, Reader args)
+	{
+		std::string out;
+		const char* p = format.c_str();
+		while (*p) {
+			if (*p != '%') {
+				out += *p++;
+				continue;
+			}
+			if (p[1] == '%') {
+				out += '%';
+				p += 2;
+				continue;
+			}
+
+			std::string spec = "%";
+			++p;
+			while (*p && strchr("-+ #0'", *p)) { spec += *p++; }
+			for (int part = 0; part < 2; ++part) {
+				// Width, then precision.
+				if (part == 1) {
+					if (*p != '.') { break; }
+					spec += *p++;
+				}
+				if (*p == '*') {
+					Arg star;
+					read_arg(args, star);
+					spec += std::to_string(star.type == 'i' || star.type == 'l' ? star.integer : 0);
+					++p;
+				}
+				while (*p >= '0' && *p <= '9') { spec += *p++; }
+			}
+			while (*p && strchr("hlLqjzt", *p)) { ++p; } // We know the actual size of the argument.
+			if (*p == '\0') { break; }
+			const char conversion = *p++;
+			if (conversion == 'n') { continue; }
+
+			Arg arg;
+			read_arg(args, arg);
+			format_arg(out, spec, conversion, arg);
+		}
+		return out;
+	}
+
+	static const char* level_text(int verbosity)
+	{
+		if (verbosity <= -3) { return " F\t"; }
+		if (verbosity == -2) { return " E\t"; }
+		if (verbosity == -1) { return " W\t"; }
+		if (verbosity ==  0) { return " I\t"; }
+		return "";
+	}
+
+	static const char* filename(const char* path)
+	{
+		for (auto ptr = path; *ptr; ++ptr) {
+			if (*ptr == '/' || *ptr == '\\') {
+				path = ptr + 1;
+			}
+		}
+		return path;
+	}
+
+	static void print_line(FILE* out, const Site& site, const std::string& thread_name, int verbosity,
+		int64_t ms_since_epoch, int64_t uptime_ms, const std::string& message)
+	{
+		time_t sec_since_epoch = time_t(ms_since_epoch / 1000);
+		tm time_info;
+#ifdef _WIN32
+		localtime_s(&time_info, &sec_since_epoch);
+#else
+		localtime_r(&sec_since_epoch, &time_info);
+#endif
+		// Same layout as print_preamble in loguru.cpp
+		fprintf(out, "%04d-%02d-%02d %02d:%02d:%02d.%03lld (%8.3fs) [%-*s]%23s:%-5u %4s| %s\n",
+			1900 + time_info.tm_year, 1 + time_info.tm_mon, time_info.tm_mday,
+			time_info.tm_hour, time_info.tm_min, time_info.tm_sec, static_cast<long long>(ms_since_epoch % 1000),
+			uptime_ms / 1000.0,
+			THREAD_NAME_WIDTH, thread_name.c_str(),
+			filename(site.file.c_str()), site.line, level_text(verbosity), message.c_str());
+	}
+
+	static bool decode(const std::vector<char>& data, FILE* out)
+	{
+		const size_t magic_size = sizeof(BINARY_MAGIC) - 1;
+		if (data.size() < magic_size || memcmp(data.data(), BINARY_MAGIC, magic_size) != 0) {
+			fprintf(stderr, "Not a Loguru binary log.\n");
+			return false;
+		}
+
+		std::map<uint32_t, Site>        sites;
+		std::map<uint32_t, std::string> thread_names;
+		Reader in(data.data() + magic_size, data.data() + data.size());
+
+		while (!in.empty()) {
+			char kind = 0;
+			in.read(kind);
+			bool ok = true;
+			if (kind == 'S') {
+				uint32_t id;
+				Site site;
+				ok = in.read(id) && in.read(site.line) && in.read_string(site.file) && in.read_string(site.format);
+				if (ok) { sites[id] = site; }
+			}
+			else if (kind == 'T') {
+				uint32_t id;
+				std::string name;
+				ok = in.read(id) && in.read_string(name);
+				if (ok) { thread_names[id] = name; }
+			}
+			else if (kind == 'M') {
+				uint32_t site_id, thread_id;
+				int32_t verbosity;
+				int64_t ms_since_epoch, uptime_ms;
+				uint16_t args_size;
+				Reader args(nullptr, nullptr);
+				ok = in.read(site_id) && in.read(thread_id) && in.read(verbosity)
+					&& in.read(ms_since_epoch) && in.read(uptime_ms)
+					&& in.read(args_size) && in.read_bytes(args_size, args);
+				if (ok) {
+					auto site = sites.find(site_id);
+					if (site == sites.end()) {
+						fprintf(stderr, "Message refers to unknown site %u.\n", site_id);
+						return false;
+					}
+					const auto message = format_message(site->second.format, args);
+					print_line(out, site->second, thread_names[thread_id], verbosity, ms_since_epoch, uptime_ms, message);
+				}
+			}
+			else {
+				ok = false;
+			}
+
+			if (!ok) {
+				fprintf(stderr, "Truncated or corrupt binary log.\n");
+				return false;
+			}
+		}
+		return true;
+	}
+} // namespace loguru_decode
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "Usage: %s input.bin [output.log]\n", argv[0]);
+		return 1;
+	}
+
+	FILE* in = fopen(argv[1], "rb");
+	if (!in) {
+		fprintf(stderr, "Failed to open '%s'\n", argv[1]);
+		return 1;
+	}
+	std::vector<char> data;
+	char buff[64 * 1024];
+	size_t num_read;
+	while ((num_read = fread(buff, 1, sizeof(buff), in)) > 0) {
+		data.insert(data.end(), buff, buff + num_read);
+	}
+	fclose(in);
+
+	FILE* out = stdout;
+	if (argc == 3) {
+		out = fopen(argv[2], "w");
+		if (!out) {
+			fprintf(stderr, "Failed to open '%s'\n", argv[2]);
+			return 1;
+		}
+	}
+
+	const bool ok = loguru_decode::decode(data, out);
+	if (out != stdout) { fclose(out); }
+	return ok ? 0 : 1;
+}